@@ -1,17 +1,22 @@
 /* Implementation of simple command-line interface */
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include "console.h"
+#include "event.h"
+#include "ipc.h"
+#include "metrics.h"
 #include "report.h"
 #include "web.h"
 
@@ -20,9 +25,23 @@ int simulation = 0;
 int show_entropy = 0;
 static cmd_element_t *cmd_list = NULL;
 static param_element_t *param_list = NULL;
+
+/* Commands and parameters are also indexed by name in open-addressing hash
+ * tables, so that dispatching a line does not walk the sorted lists.
+ * Tables are kept at most half full, doubling in size when they fill up.
+ * Their sizes are powers of 2.
+ */
+#define HASH_MINSIZE 64
+static cmd_element_t **cmd_table = NULL;
+static param_element_t **param_table = NULL;
+static unsigned cmd_size = 0, param_size = 0;
+static unsigned cmd_cnt = 0, param_cnt = 0;
 static bool block_flag = false;
 static bool prompt_flag = true;
 
+/* Collect run counts and times of commands, for the web server metrics */
+static bool cmd_stats = false;
+
 /* Am I timing a command that has the console blocked? */
 static bool block_timing = false;
 
@@ -33,10 +52,14 @@ static double first_time, last_time;
  * Must create stack of buffers to handle I/O with nested source commands.
  */
 
-#define RIO_BUFSIZE 8192
+#define RIO_BUFSIZE 65536
+
+/* Longest line handed to the interpreter */
+#define MAXLINE 8192
 
 typedef struct __rio {
     int fd;                /* File descriptor */
+    bool regular;          /* Regular file, hence always readable */
     int count;             /* Unread bytes in internal buffer */
     char *bufptr;          /* Next unread byte in internal buffer */
     char buf[RIO_BUFSIZE]; /* Internal buffer */
@@ -44,15 +67,24 @@ typedef struct __rio {
 } rio_t;
 
 static rio_t *buf_stack;
-static char linebuf[RIO_BUFSIZE];
+static char linebuf[MAXLINE];
+
+/* Words of the command being interpreted point into its line.
+ * A line of MAXLINE characters cannot hold more words than this.
+ */
+#define MAXARGS (MAXLINE / 2)
+static char *cmd_argv[MAXARGS];
 
-/* Maximum file descriptor */
-static int fd_max = 0;
+/* Waits for command input together with web server connections */
+static event_loop_t *cmd_loop = NULL;
+/* Input descriptor watched by cmd_loop, or -1 if none */
+static int input_fd = -1;
 
 /* Parameters */
 static int err_limit = 5;
 static int err_cnt = 0;
 static int echo = 0;
+static int web_uring = 0;
 
 static bool quit_flag = false;
 static char *prompt = "cmd> ";
@@ -72,9 +104,106 @@ static void pop_file();
 
 static bool interpret_cmda(int argc, char *argv[]);
 
+/* FNV-1a hash of string */
+static uint32_t hash_str(const char *str)
+{
+    uint32_t h = 2166136261u;
+    while (*str) {
+        h ^= (unsigned char) *str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Hash of name, reduced to an index into a table of size entries */
+static unsigned hash_name(const char *name, unsigned size)
+{
+    return hash_str(name) & (size - 1);
+}
+
+/* Slot of command name in cmd_table, or of the empty entry ending its
+ * probe sequence
+ */
+static unsigned cmd_slot(const char *name)
+{
+    unsigned i = hash_name(name, cmd_size);
+    while (cmd_table[i] && strcmp(cmd_table[i]->name, name) != 0)
+        i = (i + 1) & (cmd_size - 1);
+    return i;
+}
+
+static unsigned param_slot(const char *name)
+{
+    unsigned i = hash_name(name, param_size);
+    while (param_table[i] && strcmp(param_table[i]->name, name) != 0)
+        i = (i + 1) & (param_size - 1);
+    return i;
+}
+
+/* Find command by name.  Return NULL if not found */
+static cmd_element_t *find_cmd(const char *name)
+{
+    return cmd_table ? cmd_table[cmd_slot(name)] : NULL;
+}
+
+/* Find parameter by name.  Return NULL if not found */
+static param_element_t *find_param(const char *name)
+{
+    return param_table ? param_table[param_slot(name)] : NULL;
+}
+
+/* Double size of cmd_table, moving every command to its new slot */
+static void grow_cmd_table()
+{
+    cmd_element_t **old = cmd_table;
+    unsigned old_size = cmd_size;
+
+    cmd_size = old_size ? old_size * 2 : HASH_MINSIZE;
+    cmd_table = calloc_or_fail(cmd_size, sizeof(cmd_element_t *),
+                               "grow_cmd_table");
+    for (unsigned i = 0; i < old_size; i++) {
+        if (old[i])
+            cmd_table[cmd_slot(old[i]->name)] = old[i];
+    }
+    if (old)
+        free_array(old, old_size, sizeof(cmd_element_t *));
+}
+
+static void grow_param_table()
+{
+    param_element_t **old = param_table;
+    unsigned old_size = param_size;
+
+    param_size = old_size ? old_size * 2 : HASH_MINSIZE;
+    param_table = calloc_or_fail(param_size, sizeof(param_element_t *),
+                                 "grow_param_table");
+    for (unsigned i = 0; i < old_size; i++) {
+        if (old[i])
+            param_table[param_slot(old[i]->name)] = old[i];
+    }
+    if (old)
+        free_array(old, old_size, sizeof(param_element_t *));
+}
+
+/* Drop both tables, once their lists are freed */
+static void free_tables()
+{
+    if (cmd_table)
+        free_array(cmd_table, cmd_size, sizeof(cmd_element_t *));
+    if (param_table)
+        free_array(param_table, param_size, sizeof(param_element_t *));
+    cmd_table = NULL;
+    param_table = NULL;
+    cmd_size = param_size = 0;
+    cmd_cnt = param_cnt = 0;
+}
+
 /* Add a new command */
 void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
 {
+    if (cmd_cnt >= cmd_size / 2)
+        grow_cmd_table();
+
     cmd_element_t *next_cmd = cmd_list;
     cmd_element_t **last_loc = &cmd_list;
     while (next_cmd && strcmp(name, next_cmd->name) > 0) {
@@ -87,13 +216,24 @@ void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
     cmd->operation = operation;
     cmd->summary = summary;
     cmd->param = param;
+    cmd->calls = 0;
+    cmd->time = 0;
     cmd->next = next_cmd;
     *last_loc = cmd;
+
+    /* Later definition of the same name takes precedence */
+    unsigned i = cmd_slot(name);
+    if (!cmd_table[i])
+        cmd_cnt++;
+    cmd_table[i] = cmd;
 }
 
 /* Add a new parameter */
 void add_param(char *name, int *valp, char *summary, setter_func_t setter)
 {
+    if (param_cnt >= param_size / 2)
+        grow_param_table();
+
     param_element_t *next_param = param_list;
     param_element_t **last_loc = &param_list;
     while (next_param && strcmp(name, next_param->name) > 0) {
@@ -109,53 +249,75 @@ void add_param(char *name, int *valp, char *summary, setter_func_t setter)
     param->setter = setter;
     param->next = next_param;
     *last_loc = param;
+
+    unsigned i = param_slot(name);
+    if (!param_table[i])
+        param_cnt++;
+    param_table[i] = param;
 }
 
-/* Parse a string into a command line */
-static char **parse_args(char *line, int *argcp)
+/* Parse a string into a command line.
+ * Words are split in place: white space following each word is overwritten
+ * with a null character and argv receives pointers into line.
+ * Return number of words, or -1 if there are more than maxargs of them.
+ */
+static int parse_args(char *line, char *argv[], int maxargs)
 {
-    /* Must first determine how many arguments there are.
-     * Replace all white space with null characters
-     */
-    size_t len = strlen(line);
-
-    /* First copy into buffer with each substring null-terminated */
-    char *buf = malloc_or_fail(len + 1, "parse_args");
-    buf[len] = '\0';
-
     char *src = line;
-    char *dst = buf;
-    bool skipping = true;
-    int c;
     int argc = 0;
-    while ((c = *src++) != '\0') {
-        if (isspace(c)) {
-            if (!skipping) {
-                /* Hit end of word */
-                *dst++ = '\0';
-                skipping = true;
-            }
-        } else {
-            if (skipping) {
-                /* Hit start of new word */
-                argc++;
-                skipping = false;
-            }
-            *dst++ = c;
-        }
+    while (*src) {
+        while (isspace(*src))
+            src++;
+        if (!*src)
+            break;
+
+        /* Hit start of new word */
+        if (argc == maxargs)
+            return -1;
+        argv[argc++] = src;
+        while (*src && !isspace(*src))
+            src++;
+        if (*src)
+            *src++ = '\0';
     }
 
-    /* Now assemble into array of strings */
-    char **argv = calloc_or_fail(argc, sizeof(char *), "parse_args");
-    src = buf;
-    for (int i = 0; i < argc; i++) {
-        argv[i] = strsave_or_fail(src, "parse_args");
-        src += strlen(argv[i]) + 1;
+    return argc;
+}
+
+/* Growable byte buffer */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t size;
+} vbuf_t;
+
+static void vbuf_append(vbuf_t *b, const void *p, size_t n)
+{
+    if (b->len + n > b->size) {
+        size_t size = b->size ? b->size * 2 : 4096;
+        while (size < b->len + n)
+            size *= 2;
+        char *data = malloc_or_fail(size, "vbuf_append");
+        if (b->data) {
+            memcpy(data, b->data, b->len);
+            free_block(b->data, b->size);
+        }
+        b->data = data;
+        b->size = size;
     }
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+}
 
-    free_block(buf, len + 1);
-    *argcp = argc;
-    return argv;
+static void vbuf_append_u32(vbuf_t *b, uint32_t v)
+{
+    vbuf_append(b, &v, sizeof(v));
+}
+
+static void vbuf_release(vbuf_t *b)
+{
+    if (b->data)
+        free_block(b->data, b->size);
 }
 
 static void record_error()
@@ -167,18 +329,23 @@ static void record_error()
     }
 }
 
-/* Execute a command that has already been split into arguments */
-static bool interpret_cmda(int argc, char *argv[])
+/* Execute command already looked up.  cmd is NULL if argv[0] is unknown */
+static bool exec_cmd(cmd_element_t *cmd, int argc, char *argv[])
 {
-    if (argc == 0)
-        return true;
-    /* Try to find matching command */
-    cmd_element_t *next_cmd = cmd_list;
     bool ok = true;
-    while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
-        next_cmd = next_cmd->next;
-    if (next_cmd) {
-        ok = next_cmd->operation(argc, argv);
+    if (cmd && cmd_stats) {
+        double start;
+        init_time(&start);
+        ok = cmd->operation(argc, argv);
+        /* quit releases the command table, cmd included */
+        if (cmd_list) {
+            cmd->calls++;
+            cmd->time += delta_time(&start);
+        }
+        if (!ok)
+            record_error();
+    } else if (cmd) {
+        ok = cmd->operation(argc, argv);
         if (!ok)
             record_error();
     } else {
@@ -190,20 +357,248 @@ static bool interpret_cmda(int argc, char *argv[])
     return ok;
 }
 
+/* Execute a command that has already been split into arguments */
+static bool interpret_cmda(int argc, char *argv[])
+{
+    if (argc == 0)
+        return true;
+    /* Try to find matching command */
+    return exec_cmd(find_cmd(argv[0]), argc, argv);
+}
+
+/* Loops
+ *
+ * 'repeat n {' records the commands that follow, up to the matching '}',
+ * and then runs them n times.  Commands are split and looked up once while
+ * being recorded, so running a loop does not touch any text.  Within a
+ * recorded command, '$i' is replaced by the iteration number of the
+ * innermost loop, counting from 0.
+ */
+typedef struct __loop loop_t;
+
+typedef struct {
+    cmd_element_t *cmd; /* NULL if command is unknown */
+    int argc;
+    char **argv;
+    bool counter; /* Some word contains '$i' */
+    loop_t *loop; /* Nested loop, in place of a command */
+} loop_cmd_t;
+
+struct __loop {
+    int count;      /* Number of iterations */
+    vbuf_t cmds;    /* Array of loop_cmd_t */
+    loop_t *parent; /* Enclosing loop, while recording */
+};
+
+/* Innermost loop being recorded from the console and the files it sources.
+ * NULL when commands are executed.
+ */
+static loop_t *console_loop = NULL;
+
+/* Loop being recorded by the source of the command interpreted, which is
+ * console_loop unless the command comes from the web server.  Sources never
+ * see each other's loop.
+ */
+static loop_t **recording = &console_loop;
+
+/* Words of a loop command after replacing '$i' */
+static char *loop_argv[MAXARGS];
+static char loop_words[4 * MAXLINE];
+
+static loop_t *new_loop(int count, loop_t *parent)
+{
+    loop_t *loop = malloc_or_fail(sizeof(loop_t), "new_loop");
+    loop->count = count;
+    memset(&loop->cmds, 0, sizeof(loop->cmds));
+    loop->parent = parent;
+    return loop;
+}
+
+static void free_loop(loop_t *loop)
+{
+    loop_cmd_t *cmds = (loop_cmd_t *) loop->cmds.data;
+    size_t ncmd = loop->cmds.len / sizeof(loop_cmd_t);
+    for (size_t n = 0; n < ncmd; n++) {
+        if (cmds[n].loop) {
+            free_loop(cmds[n].loop);
+            continue;
+        }
+        for (int i = 0; i < cmds[n].argc; i++)
+            free_string(cmds[n].argv[i]);
+        free_array(cmds[n].argv, cmds[n].argc, sizeof(char *));
+    }
+    vbuf_release(&loop->cmds);
+    free_block(loop, sizeof(loop_t));
+}
+
+/* Replace '$i' in words of lc by iter.  Return the resulting words, or
+ * NULL if they do not fit in loop_words.
+ */
+static char **expand_counter(loop_cmd_t *lc, int iter)
+{
+    char num[16];
+    size_t numlen = snprintf(num, sizeof(num), "%d", iter);
+    char *dst = loop_words;
+    char *end = loop_words + sizeof(loop_words);
+
+    for (int i = 0; i < lc->argc; i++) {
+        loop_argv[i] = dst;
+        char *src = lc->argv[i];
+        while (*src) {
+            bool counter = src[0] == '$' && src[1] == 'i';
+            size_t n = counter ? numlen : 1;
+            /* Keep room for the null character ending the word */
+            if ((size_t) (end - dst) <= n)
+                return NULL;
+            if (counter) {
+                memcpy(dst, num, numlen);
+                src += 2;
+            } else {
+                *dst = *src++;
+            }
+            dst += n;
+        }
+        *dst++ = '\0';
+    }
+    return loop_argv;
+}
+
+/* Execute command, and emit its metrics record */
+static bool exec_metered(cmd_element_t *cmd, int argc, char *argv[])
+{
+    metrics_start();
+    bool ok = exec_cmd(cmd, argc, argv);
+    metrics_record(argc, argv, ok);
+    return ok;
+}
+
+static bool run_loop(loop_t *loop)
+{
+    bool ok = true;
+    loop_cmd_t *cmds = (loop_cmd_t *) loop->cmds.data;
+    size_t ncmd = loop->cmds.len / sizeof(loop_cmd_t);
+
+    for (int iter = 0; iter < loop->count && !quit_flag; iter++) {
+        for (size_t n = 0; n < ncmd && !quit_flag; n++) {
+            loop_cmd_t *lc = &cmds[n];
+            if (lc->loop) {
+                ok = run_loop(lc->loop) && ok;
+                continue;
+            }
+            char **argv = lc->counter ? expand_counter(lc, iter) : lc->argv;
+            if (!argv) {
+                report(1, "ERROR: Command '%s' too long after replacing '$i'",
+                       lc->argv[0]);
+                record_error();
+                ok = false;
+                continue;
+            }
+            ok = exec_metered(lc->cmd, lc->argc, argv) && ok;
+        }
+    }
+    return ok;
+}
+
+/* Check arguments of 'repeat n {' and extract n */
+static bool loop_count(int argc, char *argv[], int *count)
+{
+    if (argc != 3 || strcmp(argv[2], "{") != 0) {
+        report(1, "%s needs arguments 'n {'", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], count) || *count < 0) {
+        report(1, "Invalid number of iterations '%s'", argv[1]);
+        return false;
+    }
+    return true;
+}
+
+/* Add command to the loop being recorded, or finish the loop on '}' */
+static bool record_cmd(cmd_element_t *cmd, int argc, char *argv[])
+{
+    loop_cmd_t lc = {.cmd = cmd};
+
+    if (strcmp(argv[0], "}") == 0) {
+        loop_t *loop = *recording;
+        *recording = loop->parent;
+        if (*recording)
+            return true;
+
+        /* Outermost loop is complete */
+        bool ok = run_loop(loop);
+        free_loop(loop);
+        return ok;
+    }
+
+    if (strcmp(argv[0], "repeat") == 0) {
+        int count;
+        if (!loop_count(argc, argv, &count)) {
+            record_error();
+            return false;
+        }
+        lc.loop = new_loop(count, *recording);
+        vbuf_append(&(*recording)->cmds, &lc, sizeof(lc));
+        *recording = lc.loop;
+        return true;
+    }
+
+    lc.argc = argc;
+    lc.argv = calloc_or_fail(argc, sizeof(char *), "record_cmd");
+    for (int i = 0; i < argc; i++) {
+        lc.argv[i] = strsave_or_fail(argv[i], "record_cmd");
+        if (strstr(argv[i], "$i"))
+            lc.counter = true;
+    }
+    vbuf_append(&(*recording)->cmds, &lc, sizeof(lc));
+    return true;
+}
+
+/* Discard loop left unfinished at end of input of its source.  Return false
+ * if there was one.
+ */
+static bool end_loop(loop_t **loop)
+{
+    if (!*loop)
+        return true;
+
+    report(1, "ERROR: Loop not ended with '}'");
+    record_error();
+    while ((*loop)->parent)
+        *loop = (*loop)->parent;
+    free_loop(*loop);
+    *loop = NULL;
+    return false;
+}
+
+/* Execute command, or record it when inside a loop.  Lines recorded are
+ * not in the metrics, but each command run by the loop is.
+ */
+static bool dispatch_cmd(cmd_element_t *cmd, int argc, char *argv[])
+{
+    if (*recording)
+        return record_cmd(cmd, argc, argv);
+    return exec_metered(cmd, argc, argv);
+}
+
 /* Execute a command from a command line */
 static bool interpret_cmd(char *cmdline)
 {
     if (quit_flag)
         return false;
 
-    int argc;
-    char **argv = parse_args(cmdline, &argc);
-    bool ok = interpret_cmda(argc, argv);
-    for (int i = 0; i < argc; i++)
-        free_string(argv[i]);
-    free_array(argv, argc, sizeof(char *));
+    /* Output may follow the last prompt, so show it again */
+    prompt_flag = true;
+    int argc = parse_args(cmdline, cmd_argv, MAXARGS);
+    if (argc < 0) {
+        report(1, "Too many arguments (limit is %d)", MAXARGS);
+        record_error();
+        return false;
+    }
 
-    return ok;
+    if (argc == 0)
+        return true;
+
+    return dispatch_cmd(find_cmd(cmd_argv[0]), argc, cmd_argv);
 }
 
 /* Set function to be executed as part of program exit */
@@ -238,10 +633,16 @@ static bool do_quit(int argc, char *argv[])
         p = p->next;
         free_block(ele, sizeof(param_element_t));
     }
+    cmd_list = NULL;
+    param_list = NULL;
+    free_tables();
 
     while (buf_stack)
         pop_file();
 
+    /* Discard loop left unfinished, at end of input or on quit */
+    end_loop(&console_loop);
+
     for (int i = 0; i < quit_helper_cnt; i++) {
         ok = ok && quit_helpers[i](argc, argv);
     }
@@ -250,6 +651,23 @@ static bool do_quit(int argc, char *argv[])
     return ok;
 }
 
+static bool do_repeat(int argc, char *argv[])
+{
+    int count;
+    if (!loop_count(argc, argv, &count))
+        return false;
+
+    *recording = new_loop(count, NULL);
+    return true;
+}
+
+/* Reached only when no loop is being recorded */
+static bool do_end_repeat(int argc, char *argv[])
+{
+    report(1, "No loop to end with '%s'", argv[0]);
+    return false;
+}
+
 static bool do_help(int argc, char *argv[])
 {
     cmd_element_t *clist = cmd_list;
@@ -320,17 +738,14 @@ static bool do_option(int argc, char *argv[])
             report(1, "Cannot parse '%s' as integer", argv[i]);
             return false;
         }
-        /* Find parameter in list */
-        param_element_t *plist = param_list;
-        while (!found && plist) {
-            if (strcmp(plist->name, name) == 0) {
-                int oldval = *plist->valp;
-                *plist->valp = value;
-                if (plist->setter)
-                    plist->setter(oldval);
-                found = true;
-            } else
-                plist = plist->next;
+        /* Find parameter in table */
+        param_element_t *plist = find_param(name);
+        if (plist) {
+            int oldval = *plist->valp;
+            *plist->valp = value;
+            if (plist->setter)
+                plist->setter(oldval);
+            found = true;
         }
         /* Didn't find parameter */
         if (!found) {
@@ -367,6 +782,8 @@ static bool do_log(int argc, char *argv[])
     bool result = set_logfile(argv[1]);
     if (!result)
         report(1, "Couldn't open log file '%s'", argv[1]);
+    else
+        web_add_file(argv[1]);
 
     return result;
 }
@@ -391,8 +808,66 @@ static bool do_time(int argc, char *argv[])
     return ok;
 }
 
+/* Lines typed on the terminal are edited, fed from the event loop */
 static bool use_linenoise = true;
-static int web_fd;
+static bool editing = false; /* Line editor shows prompt and takes keys */
+static int web_fd = -1;
+/* Requests also arrive through web server or command channel */
+static bool serving = false;
+static ipc_handler_t ipc_handler = NULL;
+
+/* Number of commands run from a file between checks of the web server */
+#define WEB_POLL_INTERVAL 64
+
+/* Add run counts and times of commands to metrics export */
+static void cmd_metrics()
+{
+    char labels[128];
+
+    metrics_family("qtest_commands_total", "counter",
+                   "Commands run since the web server started");
+    for (cmd_element_t *cmd = cmd_list; cmd; cmd = cmd->next) {
+        snprintf(labels, sizeof(labels), "cmd=\"%s\"", cmd->name);
+        metrics_sample("qtest_commands_total", labels, cmd->calls);
+    }
+    metrics_family("qtest_command_seconds_total", "counter",
+                   "Time spent running commands");
+    for (cmd_element_t *cmd = cmd_list; cmd; cmd = cmd->next) {
+        snprintf(labels, sizeof(labels), "cmd=\"%s\"", cmd->name);
+        metrics_sample("qtest_command_seconds_total", labels, cmd->time);
+    }
+}
+
+static void web_emit(char *text)
+{
+    web_send(web_connfd, text);
+}
+
+/* Run command requested from web server, recording loops in *state, which
+ * belongs to its request or script.  /metrics is answered with the metrics
+ * export instead, produced between commands like any request.
+ */
+static bool web_cmd(char *cmdline, void **state)
+{
+    loop_t *loop = *state;
+    loop_t **saved = recording;
+    bool ok = true;
+
+    recording = &loop;
+    if (!cmdline) {
+        ok = end_loop(&loop);
+    } else if (strcmp(cmdline, "metrics") == 0) {
+        metrics_export(web_emit);
+    } else {
+        /* Output goes to the terminal too, not into the line being typed */
+        line_edit_hide();
+        ok = interpret_cmd(cmdline);
+        line_edit_show();
+    }
+    recording = saved;
+    *state = loop;
+    return ok;
+}
 
 static bool do_web(int argc, char *argv[])
 {
@@ -402,10 +877,18 @@ static bool do_web(int argc, char *argv[])
             port = atoi(argv[1]);
     }
 
-    web_fd = web_open(port);
+    bool uring = web_uring;
+    web_fd = web_open(port, cmd_loop, web_cmd, &uring);
     if (web_fd > 0) {
-        printf("listen on port %d, fd is %d\n", port, web_fd);
-        use_linenoise = false;
+        cmd_stats = true;
+        web_add_file("traces/");
+        /* Metrics file is served from now on, so keep it up to date */
+        metrics_set_sync(true);
+        if (web_uring && !uring)
+            report(1, "io_uring not available, using event loop instead");
+        printf("listen on port %d, fd is %d%s\n", port, web_fd,
+               uring ? " (io_uring)" : "");
+        serving = true;
     } else {
         perror("ERROR");
         exit(web_fd);
@@ -413,13 +896,50 @@ static bool do_web(int argc, char *argv[])
     return true;
 }
 
+static bool do_ipc(int argc, char *argv[])
+{
+    if (argc > 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    char *path = argc == 2 ? argv[1] : IPC_DEFAULT_PATH;
+    int fd = ipc_open(path, cmd_loop, ipc_handler);
+    if (fd < 0) {
+        report(1, "ERROR: Cannot listen on %s: %s", path, strerror(errno));
+        return false;
+    }
+    report(1, "listen on %s, fd is %d", path, fd);
+    serving = true;
+    return true;
+}
+
+/* Remove socket of command channel, so that none is left behind */
+static bool ipc_quit(int argc, char *argv[])
+{
+    ipc_close();
+    return true;
+}
+
+void add_ipc_command(ipc_handler_t handler)
+{
+    ipc_handler = handler;
+    add_quit_helper(ipc_quit);
+    ADD_COMMAND(ipc, "Accept binary queue operations on Unix domain socket",
+                "[path]");
+}
+
 /* Initialize interpreter */
 void init_cmd()
 {
     cmd_list = NULL;
     param_list = NULL;
+    free_tables();
     err_cnt = 0;
     quit_flag = false;
+    if (!cmd_loop)
+        cmd_loop = event_loop_new();
+    metrics_add_export_func(cmd_metrics);
 
     ADD_COMMAND(help, "Show summary", "");
     ADD_COMMAND(option,
@@ -430,11 +950,18 @@ void init_cmd()
     ADD_COMMAND(log, "Copy output to file", "file");
     ADD_COMMAND(time, "Time command execution", "cmd arg ...");
     ADD_COMMAND(web, "Read commands from builtin web server", "[port]");
+    ADD_COMMAND(repeat,
+                "Run commands up to matching '}' n times. '$i' in them "
+                "stands for the iteration number",
+                "n {");
+    add_cmd("}", do_end_repeat, "End commands run by repeat", "");
     add_cmd("#", do_comment_cmd, "Display comment", "...");
     add_param("simulation", &simulation, "Start/Stop simulation mode", NULL);
     add_param("verbose", &verblevel, "Verbosity level", NULL);
     add_param("error", &err_limit, "Number of errors until exit", NULL);
     add_param("echo", &echo, "Do/don't echo commands", NULL);
+    add_param("web_uring", &web_uring,
+              "Serve web connections with io_uring, if available", NULL);
     add_param("entropy", &show_entropy, "Show/Hide Shannon entropy", NULL);
 
     init_in();
@@ -453,11 +980,10 @@ static bool push_file(char *fname)
     if (fd < 0)
         return false;
 
-    if (fd > fd_max)
-        fd_max = fd;
-
+    struct stat st;
     rio_t *rnew = malloc_or_fail(sizeof(rio_t), "push_file");
     rnew->fd = fd;
+    rnew->regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
     rnew->count = 0;
     rnew->bufptr = rnew->buf;
     rnew->prev = buf_stack;
@@ -472,6 +998,10 @@ static void pop_file()
     if (buf_stack) {
         rio_t *rsave = buf_stack;
         buf_stack = rsave->prev;
+        if (rsave->fd == input_fd) {
+            event_del(cmd_loop, input_fd);
+            input_fd = -1;
+        }
         close(rsave->fd);
         free_block(rsave, sizeof(rio_t));
     }
@@ -484,17 +1014,20 @@ static void init_in()
 }
 
 /* Read command from input file.
+ * Lines are located with memchr and copied out of the input buffer in one
+ * piece, so the cost per line does not depend on a loop over characters.
  * When hit EOF, close that file and return NULL
  */
 static char *readline()
 {
-    char c;
     char *lptr = linebuf;
+    /* Leave room for terminating newline and null character */
+    char *lend = linebuf + MAXLINE - 2;
 
     if (!buf_stack)
         return NULL;
 
-    for (int cnt = 0; cnt < RIO_BUFSIZE - 2; cnt++) {
+    while (lptr < lend) {
         if (buf_stack->count <= 0) {
             /* Need to read from input file */
             buf_stack->count = read(buf_stack->fd, buf_stack->buf, RIO_BUFSIZE);
@@ -502,31 +1035,30 @@ static char *readline()
             if (buf_stack->count <= 0) {
                 /* Encountered EOF */
                 pop_file();
-                if (cnt > 0) {
-                    /* Last line of file did not terminate with newline. */
-                    /*  Terminate line & return it */
-                    *lptr++ = '\n';
-                    *lptr++ = '\0';
-                    if (echo) {
-                        report_noreturn(1, prompt);
-                        report_noreturn(1, linebuf);
-                    }
-                    return linebuf;
-                }
-                return NULL;
+                if (lptr == linebuf)
+                    return NULL;
+                /* Last line of file did not terminate with newline. */
+                break;
             }
         }
 
         /* Have text in buffer */
-        c = *buf_stack->bufptr++;
-        *lptr++ = c;
-        buf_stack->count--;
-        if (c == '\n')
+        size_t n = buf_stack->count;
+        if (n > lend - lptr)
+            n = lend - lptr;
+        char *nl = memchr(buf_stack->bufptr, '\n', n);
+        if (nl)
+            n = nl - buf_stack->bufptr + 1;
+        memcpy(lptr, buf_stack->bufptr, n);
+        lptr += n;
+        buf_stack->bufptr += n;
+        buf_stack->count -= n;
+        if (nl)
             break;
     }
 
-    if (c != '\n') {
-        /* Hit buffer limit.  Artificially terminate line */
+    if (lptr[-1] != '\n') {
+        /* Hit buffer limit or EOF.  Artificially terminate line */
         *lptr++ = '\n';
     }
     *lptr++ = '\0';
@@ -544,88 +1076,141 @@ static bool cmd_done()
     return !buf_stack || quit_flag;
 }
 
-/* Handle command processing in program that uses select as main control loop.
- * Like select, but checks whether command input either present in internal
- * buffer
- * or readable from command input.  If so, that command is executed.
- * Same return as select.  Command input file removed from readfds
- *
- * nfds should be set to the maximum file descriptor for network sockets.
- * If nfds == 0, this indicates that there is no pending network activity
- */
-int web_connfd;
-static int cmd_select(int nfds,
-                      fd_set *readfds,
-                      fd_set *writefds,
-                      fd_set *exceptfds,
-                      struct timeval *timeout)
+/* Run next command of input file fd, if still at top of the stack */
+static void input_ready(int fd, void *arg)
 {
-    int infd;
-    fd_set local_readset;
+    if (!buf_stack || fd != buf_stack->fd) {
+        /* Picked up again by cmd_select once back at top of the stack */
+        event_del(cmd_loop, fd);
+        input_fd = -1;
+        return;
+    }
 
-    if (cmd_done())
-        return 0;
+    set_echo(0);
+    char *cmdline = readline();
+    if (cmdline)
+        interpret_cmd(cmdline);
+}
+
+/* Run line typed on the terminal, or quit at its end of input */
+static void line_ready(char *cmdline)
+{
+    if (!cmdline) {
+        editing = false;
+        pop_file();
+        return;
+    }
+    /* Add to the history and append to the file on disk first, as
+     * interpret_cmd splits cmdline in place
+     */
+    if (line_history_add(cmdline))
+        line_history_append(HISTORY_FILE);
+    interpret_cmd(cmdline);
+    line_free(cmdline);
+    /* No prompt while a sourced file runs, nor after quitting */
+    if (cmd_done() || buf_stack->fd != STDIN_FILENO) {
+        line_edit_stop();
+        editing = false;
+    }
+}
+
+/* Feed byte typed on the terminal to the line editor */
+static void line_input(int fd, void *arg)
+{
+    if (!buf_stack || fd != buf_stack->fd) {
+        /* Keys wait until the sourced file is done */
+        event_del(cmd_loop, fd);
+        input_fd = -1;
+        return;
+    }
 
-    if (!block_flag) {
-        /* Process any commands in input buffer */
-        if (!readfds)
-            readfds = &local_readset;
+    char c;
+    if (read(fd, &c, 1) <= 0) {
+        line_edit_stop();
+        editing = false;
+        pop_file();
+        return;
+    }
+    line_edit_feed(c);
+}
 
-        /* Add input fd to readset for select */
-        infd = buf_stack->fd;
-        FD_ZERO(readfds);
-        FD_SET(infd, readfds);
+/* Handle command processing in program that uses the event loop as main
+ * control loop.  Runs the next command if it is already in the internal
+ * buffer or readable from command input.  Otherwise waits up to timeout
+ * milliseconds (-1 for no limit) for command input or web requests.
+ * Return number of inputs handled, 0 on timeout, or -1 on error.
+ */
+static int cmd_select(int timeout)
+{
+    if (cmd_done() || block_flag)
+        return 0;
 
-        /* If web not ready listen */
-        if (web_fd != -1)
-            FD_SET(web_fd, readfds);
+    if (buf_stack->count > 0) {
+        /* Input already buffered: no need to ask the kernel first */
+        input_ready(buf_stack->fd, NULL);
+        return 1;
+    }
 
-        if (infd == STDIN_FILENO && prompt_flag) {
-            printf("%s", prompt);
-            fflush(stdout);
-            prompt_flag = true;
-        }
+    int infd = buf_stack->fd;
+    if (infd == STDIN_FILENO && use_linenoise && !editing) {
+        /* The editor shows the prompt, and may run pasted lines at once */
+        editing = true;
+        if (line_edit_start(prompt, line_ready) < 0)
+            use_linenoise = editing = false;
+        else if (cmd_done() || buf_stack->fd != infd)
+            return 1;
+    }
+    /* Piped commands are not prompted for, unless requests are served too */
+    if (infd == STDIN_FILENO && prompt_flag && !use_linenoise &&
+        (serving || isatty(infd))) {
+        printf("%s", prompt);
+        fflush(stdout);
+        /* Not again until a command runs, whatever else wakes the loop */
+        prompt_flag = false;
+    }
 
-        if (infd >= nfds)
-            nfds = infd + 1;
-        if (web_fd >= nfds)
-            nfds = web_fd + 1;
+    if (buf_stack->regular) {
+        /* Regular files are always readable, but cannot be watched */
+        event_wait(cmd_loop, 0);
+        if (cmd_done())
+            return 0;
+        input_ready(buf_stack->fd, NULL);
+        return 1;
     }
-    if (nfds == 0)
-        return 0;
 
-    int result = select(nfds, readfds, writefds, exceptfds, timeout);
-    if (result <= 0)
-        return result;
+    if (infd != input_fd) {
+        if (input_fd >= 0)
+            event_del(cmd_loop, input_fd);
+        event_handler_t handler =
+            infd == STDIN_FILENO && use_linenoise ? line_input : input_ready;
+        input_fd = event_add(cmd_loop, infd, handler, NULL) ? infd : -1;
+    }
+    return event_wait(cmd_loop, timeout);
+}
 
-    infd = buf_stack->fd;
-    if (readfds && FD_ISSET(infd, readfds)) {
-        /* Commandline input available */
-        FD_CLR(infd, readfds);
-        result--;
+/* Run commands from input files in a tight loop.
+ * Regular files are always readable, so rather than waiting for input before
+ * every line, the web server (when active) is checked every
+ * WEB_POLL_INTERVAL commands.  Input that may block, such as a pipe, is
+ * still waited for together with web requests.
+ */
+static void run_batch()
+{
+    int cnt = 0;
+    while (!cmd_done()) {
+        if (serving && !buf_stack->regular && buf_stack->count <= 0) {
+            cmd_select(-1);
+            continue;
+        }
+        /* Serve pending web requests, if any, without waiting for one */
+        if (serving && ++cnt % WEB_POLL_INTERVAL == 0)
+            event_wait(cmd_loop, 0);
 
         set_echo(0);
         char *cmdline = readline();
         if (cmdline)
             interpret_cmd(cmdline);
-    } else if (readfds && FD_ISSET(web_fd, readfds)) {
-        FD_CLR(web_fd, readfds);
-        result--;
-        struct sockaddr_in clientaddr;
-        socklen_t clientlen = sizeof(clientaddr);
-        web_connfd =
-            accept(web_fd, (struct sockaddr *) &clientaddr, &clientlen);
-
-        char *p = web_recv(web_connfd, &clientaddr);
-        char *buffer = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n";
-        web_send(web_connfd, buffer);
-
-        if (p)
-            interpret_cmd(p);
-        free(p);
-        close(web_connfd);
     }
-    return result;
 }
 
 bool finish_cmd()
@@ -648,12 +1233,17 @@ static bool cmd_maybe(const char *target, const char *src)
     return true;
 }
 
+/* Both lists are sorted by name, so the candidates completing buf form a
+ * contiguous run and the walk can stop once it is past that run.
+ */
 void completion(const char *buf, line_completions_t *lc)
 {
+    bool matched = false;
+
     if (strncmp("option ", buf, 7) == 0) {
         param_element_t *plist = param_list;
 
-        while (plist) {
+        for (; plist; plist = plist->next) {
             char str[128] = "";
             /* if parameter is too long, now we just ignore it */
             if (strlen(plist->name) > 120)
@@ -661,20 +1251,24 @@ void completion(const char *buf, line_completions_t *lc)
 
             strcat(str, "option ");
             strcat(str, plist->name);
-            if (cmd_maybe(str, buf))
+            if (cmd_maybe(str, buf)) {
                 line_add_completion(lc, str);
-
-            plist = plist->next;
+                matched = true;
+            } else if (matched) {
+                break;
+            }
         }
         return;
     }
 
     cmd_element_t *clist = cmd_list;
-    while (clist) {
-        if (cmd_maybe(clist->name, buf))
+    for (; clist; clist = clist->next) {
+        if (cmd_maybe(clist->name, buf)) {
             line_add_completion(lc, clist->name);
-
-        clist = clist->next;
+            matched = true;
+        } else if (matched) {
+            break;
+        }
     }
 }
 
@@ -686,24 +1280,261 @@ bool run_console(char *infile_name)
     }
 
     if (!has_infile) {
-        char *cmdline;
-        while (use_linenoise && (cmdline = linenoise(prompt))) {
-            interpret_cmd(cmdline);
-            line_history_add(cmdline);       /* Add to the history. */
-            line_history_save(HISTORY_FILE); /* Save the history on disk. */
-            line_free(cmdline);
-            while (buf_stack && buf_stack->fd != STDIN_FILENO)
-                cmd_select(0, NULL, NULL, NULL, NULL);
-            has_infile = false;
-        }
-        if (!use_linenoise) {
-            while (!cmd_done())
-                cmd_select(0, NULL, NULL, NULL, NULL);
-        }
-    } else {
+        /* Lines are edited as their keys arrive, so the web server and
+         * command channel are served while a line is typed
+         */
+        use_linenoise = isatty(STDIN_FILENO);
         while (!cmd_done())
-            cmd_select(0, NULL, NULL, NULL, NULL);
+            cmd_select(-1);
+        line_edit_stop();
+        editing = false;
+        has_infile = false;
+    } else {
+        run_batch();
     }
 
     return err_cnt == 0;
 }
+
+/* Compiled command files
+ *
+ * A compiled file holds the words of every command line of a text command
+ * file, split and interned once, so that replaying it needs neither reading
+ * and tokenizing text nor looking up commands by name.  Layout, in host byte
+ * order:
+ *
+ *   char     magic[4]        "QBC1"
+ *   uint32_t nstr, nrec, poolsize
+ *   uint32_t offset[nstr]    start of each string within pool
+ *   char     pool[poolsize]  null-terminated strings, padded to 4 bytes
+ *   records                  nrec times: argc, then argc string indices
+ */
+#define QBC_MAGIC "QBC1"
+#define QBC_HDRSIZE 16
+
+typedef struct {
+    vbuf_t pool;     /* String contents */
+    vbuf_t offsets;  /* Offset of each string within pool */
+    vbuf_t code;     /* Records */
+    uint32_t *table; /* Interned strings: string index + 1, or 0 if empty */
+    uint32_t tsize;
+    uint32_t nstr;
+    uint32_t nrec;
+} qbc_writer_t;
+
+static char *qbc_str(qbc_writer_t *w, uint32_t idx)
+{
+    return w->pool.data + ((uint32_t *) w->offsets.data)[idx];
+}
+
+/* Return index of string s, adding it to the pool if not yet present */
+static uint32_t qbc_intern(qbc_writer_t *w, const char *s)
+{
+    uint32_t i = hash_str(s) & (w->tsize - 1);
+    while (w->table[i]) {
+        if (strcmp(qbc_str(w, w->table[i] - 1), s) == 0)
+            return w->table[i] - 1;
+        i = (i + 1) & (w->tsize - 1);
+    }
+
+    uint32_t idx = w->nstr++;
+    vbuf_append_u32(&w->offsets, w->pool.len);
+    vbuf_append(&w->pool, s, strlen(s) + 1);
+    w->table[i] = idx + 1;
+
+    /* Keep table at most half full */
+    if (w->nstr * 2 > w->tsize) {
+        uint32_t tsize = w->tsize * 2;
+        uint32_t *table = calloc_or_fail(tsize, sizeof(uint32_t), "qbc_intern");
+        for (uint32_t n = 0; n < w->nstr; n++) {
+            uint32_t j = hash_str(qbc_str(w, n)) & (tsize - 1);
+            while (table[j])
+                j = (j + 1) & (tsize - 1);
+            table[j] = n + 1;
+        }
+        free_array(w->table, w->tsize, sizeof(uint32_t));
+        w->table = table;
+        w->tsize = tsize;
+    }
+
+    return idx;
+}
+
+static bool write_all(int fd, const void *buf, size_t n)
+{
+    const char *p = buf;
+    while (n > 0) {
+        ssize_t cnt = write(fd, p, n);
+        if (cnt < 0)
+            return false;
+        p += cnt;
+        n -= cnt;
+    }
+    return true;
+}
+
+bool compile_cmd(char *infile_name, char *outfile_name)
+{
+    if (!push_file(infile_name)) {
+        report(1, "ERROR: Could not open source file '%s'", infile_name);
+        return false;
+    }
+
+    qbc_writer_t w;
+    memset(&w, 0, sizeof(w));
+    w.tsize = 1024;
+    w.table = calloc_or_fail(w.tsize, sizeof(uint32_t), "compile_cmd");
+
+    bool ok = true;
+    char *cmdline;
+    set_echo(0);
+    while ((cmdline = readline())) {
+        int argc = parse_args(cmdline, cmd_argv, MAXARGS);
+        if (argc < 0) {
+            report(1, "ERROR: Too many arguments (limit is %d)", MAXARGS);
+            ok = false;
+            continue;
+        }
+        if (argc == 0)
+            continue;
+
+        vbuf_append_u32(&w.code, argc);
+        for (int i = 0; i < argc; i++)
+            vbuf_append_u32(&w.code, qbc_intern(&w, cmd_argv[i]));
+        w.nrec++;
+    }
+
+    /* Pad pool so that records stay aligned */
+    while (w.pool.len % sizeof(uint32_t))
+        vbuf_append(&w.pool, "", 1);
+
+    if (ok) {
+        int fd = open(outfile_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        uint32_t hdr[QBC_HDRSIZE / sizeof(uint32_t)];
+        memcpy(hdr, QBC_MAGIC, 4);
+        hdr[1] = w.nstr;
+        hdr[2] = w.nrec;
+        hdr[3] = w.pool.len;
+        ok = fd >= 0 && write_all(fd, hdr, sizeof(hdr)) &&
+             write_all(fd, w.offsets.data, w.offsets.len) &&
+             write_all(fd, w.pool.data, w.pool.len) &&
+             write_all(fd, w.code.data, w.code.len);
+        if (!ok)
+            report(1, "ERROR: Could not write compiled file '%s'",
+                   outfile_name);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    vbuf_release(&w.pool);
+    vbuf_release(&w.offsets);
+    vbuf_release(&w.code);
+    free_array(w.table, w.tsize, sizeof(uint32_t));
+    return ok;
+}
+
+/* Check compiled file and set up its string table.
+ * Return pointer to first record, or NULL if file is malformed.
+ */
+static const uint32_t *qbc_load(char *map, size_t size, char **strs)
+{
+    const uint32_t *hdr = (const uint32_t *) map;
+    uint32_t nstr = hdr[1], nrec = hdr[2], poolsize = hdr[3];
+
+    size_t pos = QBC_HDRSIZE + (size_t) nstr * sizeof(uint32_t);
+    if (pos + poolsize > size || poolsize % sizeof(uint32_t))
+        return NULL;
+    char *pool = map + pos;
+    if (nstr && (poolsize == 0 || pool[poolsize - 1] != '\0'))
+        return NULL;
+    for (uint32_t i = 0; i < nstr; i++) {
+        uint32_t off = hdr[4 + i];
+        if (off >= poolsize)
+            return NULL;
+        strs[i] = pool + off;
+    }
+
+    /* Make sure every record lies within the file */
+    const uint32_t *code = (const uint32_t *) (pool + poolsize);
+    const uint32_t *end = (const uint32_t *) (map + size);
+    const uint32_t *rec = code;
+    for (uint32_t r = 0; r < nrec; r++) {
+        if (rec >= end || *rec == 0 || *rec > MAXARGS ||
+            *rec > end - rec - 1)
+            return NULL;
+        for (uint32_t i = 1; i <= *rec; i++) {
+            if (rec[i] >= nstr)
+                return NULL;
+        }
+        rec += *rec + 1;
+    }
+
+    return code;
+}
+
+bool run_compiled(char *file_name)
+{
+    int fd = open(file_name, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        report(1, "ERROR: Could not open compiled file '%s'", file_name);
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    size_t size = st.st_size;
+    char *map = size >= QBC_HDRSIZE
+                    ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                           fd, 0)
+                    : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED || memcmp(map, QBC_MAGIC, 4) != 0) {
+        report(1, "ERROR: '%s' is not a compiled command file", file_name);
+        if (map != MAP_FAILED)
+            munmap(map, size);
+        return false;
+    }
+
+    uint32_t nstr = ((uint32_t *) map)[1], nrec = ((uint32_t *) map)[2];
+    if ((size_t) nstr * sizeof(uint32_t) > size) {
+        report(1, "ERROR: Compiled file '%s' is corrupted", file_name);
+        munmap(map, size);
+        return false;
+    }
+    char **strs = calloc_or_fail(nstr + 1, sizeof(char *), "run_compiled");
+    cmd_element_t **cmds =
+        calloc_or_fail(nstr + 1, sizeof(cmd_element_t *), "run_compiled");
+    const uint32_t *rec = qbc_load(map, size, strs);
+    if (!rec) {
+        report(1, "ERROR: Compiled file '%s' is corrupted", file_name);
+        nrec = 0;
+    }
+
+    /* Resolve every command name once, ahead of execution */
+    const uint32_t *code = rec;
+    for (uint32_t r = 0; r < nrec; r++) {
+        if (!cmds[code[1]])
+            cmds[code[1]] = find_cmd(strs[code[1]]);
+        code += code[0] + 1;
+    }
+
+    set_echo(0);
+    for (uint32_t r = 0; r < nrec && !quit_flag; r++) {
+        int argc = *rec++;
+        for (int i = 0; i < argc; i++)
+            cmd_argv[i] = strs[rec[i]];
+        cmd_element_t *cmd = cmds[rec[0]];
+        rec += argc;
+
+        dispatch_cmd(cmd, argc, cmd_argv);
+
+        /* Commands read by 'source' still come from text files */
+        run_batch();
+    }
+
+    free_array(strs, nstr + 1, sizeof(char *));
+    free_array(cmds, nstr + 1, sizeof(cmd_element_t *));
+    munmap(map, size);
+    return code && err_cnt == 0;
+}
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <sys/select.h>
 
+#include "ipc.h"
 #include "linenoise.h"
 
 #define HISTORY_FILE ".cmd_history"
@@ -24,6 +25,9 @@ typedef struct __cmd_element {
     cmd_func_t operation;
     char *summary;
     char *param;
+    /* Runs and seconds spent in them, counted while the web server runs */
+    unsigned long calls;
+    double time;
     struct __cmd_element *next;
 } cmd_element_t;
 
@@ -53,6 +57,14 @@ void add_param(char *name, int *valp, char *summary, setter_func_t setter);
 /* Extract integer from text and store at loc */
 bool get_int(char *vname, int *loc);
 
+/* Socket of command channel, if none is given to the ipc command */
+#define IPC_DEFAULT_PATH "qtest.sock"
+
+/* Add ipc command, which serves requests of the binary command channel
+ * with handler
+ */
+void add_ipc_command(ipc_handler_t handler);
+
 /* Add function to be executed as part of program exit */
 void add_quit_helper(cmd_func_t qf);
 
@@ -68,6 +80,14 @@ bool finish_cmd();
  */
 bool run_console(char *infile_name);
 
+/* Translate command file into compiled form, as run by run_compiled.
+ * Return true if successful
+ */
+bool compile_cmd(char *infile_name, char *outfile_name);
+
+/* Run commands from compiled file */
+bool run_compiled(char *file_name);
+
 /* Callback function to complete command by linenoise */
 void completion(const char *buf, line_completions_t *lc);
 
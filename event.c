@@ -0,0 +1,228 @@
+/* Implementation of a minimal reactor for console and web server I/O */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#include "event.h"
+
+/* Most events handled per wait */
+#define MAX_EVENTS 64
+
+typedef struct {
+    event_handler_t handler; /* NULL if descriptor not watched for input */
+    void *arg;
+    event_handler_t writer; /* NULL if not watched for room to write */
+    void *warg;
+} event_watch_t;
+
+/* Watches are indexed by file descriptor, so that a handler removed while
+ * a batch of events is dispatched is simply skipped.
+ */
+struct __event_loop {
+#if defined(__linux__)
+    int epfd;
+#else
+    struct pollfd *pfds; /* Scratch array for poll, same size as watches */
+#endif
+    event_watch_t *watches;
+    int nwatches; /* Size of watches */
+};
+
+event_loop_t *event_loop_new()
+{
+    event_loop_t *loop = calloc(1, sizeof(event_loop_t));
+    if (!loop)
+        return NULL;
+
+#if defined(__linux__)
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        free(loop);
+        return NULL;
+    }
+#endif
+    return loop;
+}
+
+void event_loop_free(event_loop_t *loop)
+{
+    if (!loop)
+        return;
+#if defined(__linux__)
+    close(loop->epfd);
+#else
+    free(loop->pfds);
+#endif
+    free(loop->watches);
+    free(loop);
+}
+
+/* Make room for watch of fd */
+static bool reserve(event_loop_t *loop, int fd)
+{
+    if (fd < loop->nwatches)
+        return true;
+
+    int n = loop->nwatches ? loop->nwatches : 16;
+    while (n <= fd)
+        n *= 2;
+    event_watch_t *w = realloc(loop->watches, n * sizeof(event_watch_t));
+    if (!w)
+        return false;
+    memset(w + loop->nwatches, 0,
+           (n - loop->nwatches) * sizeof(event_watch_t));
+    loop->watches = w;
+#if !defined(__linux__)
+    struct pollfd *pfds = realloc(loop->pfds, n * sizeof(struct pollfd));
+    if (!pfds)
+        return false;
+    loop->pfds = pfds;
+#endif
+    loop->nwatches = n;
+    return true;
+}
+
+/* Tell the kernel which events of fd are now watched, from watch w, given
+ * whether fd was watched at all before
+ */
+static bool update(event_loop_t *loop, int fd, event_watch_t *w, bool was)
+{
+#if defined(__linux__)
+    struct epoll_event ev = {.data.fd = fd};
+    if (w->handler)
+        ev.events |= EPOLLIN;
+    if (w->writer)
+        ev.events |= EPOLLOUT;
+    int op = !ev.events ? EPOLL_CTL_DEL : was ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    /* Fails with EPERM for regular files */
+    return epoll_ctl(loop->epfd, op, fd, &ev) == 0;
+#else
+    return true;
+#endif
+}
+
+bool event_add(event_loop_t *loop, int fd, event_handler_t handler, void *arg)
+{
+    if (fd < 0 || !reserve(loop, fd))
+        return false;
+
+    event_watch_t w = loop->watches[fd];
+    bool was = w.handler || w.writer;
+    w.handler = handler;
+    w.arg = arg;
+    if (!update(loop, fd, &w, was))
+        return false;
+    loop->watches[fd] = w;
+    return true;
+}
+
+void event_del(event_loop_t *loop, int fd)
+{
+    if (fd < 0 || fd >= loop->nwatches || !loop->watches[fd].handler)
+        return;
+
+    event_watch_t *w = &loop->watches[fd];
+    w->handler = NULL;
+    w->arg = NULL;
+    update(loop, fd, w, true);
+}
+
+bool event_add_write(event_loop_t *loop,
+                     int fd,
+                     event_handler_t handler,
+                     void *arg)
+{
+    if (fd < 0 || !reserve(loop, fd))
+        return false;
+
+    event_watch_t w = loop->watches[fd];
+    bool was = w.handler || w.writer;
+    w.writer = handler;
+    w.warg = arg;
+    if (!update(loop, fd, &w, was))
+        return false;
+    loop->watches[fd] = w;
+    return true;
+}
+
+void event_del_write(event_loop_t *loop, int fd)
+{
+    if (fd < 0 || fd >= loop->nwatches || !loop->watches[fd].writer)
+        return;
+
+    event_watch_t *w = &loop->watches[fd];
+    w->writer = NULL;
+    w->warg = NULL;
+    update(loop, fd, w, true);
+}
+
+/* Run handlers of fd for the events given, unless they were removed by an
+ * earlier handler.  Errors and hangups run both, so that either notices.
+ */
+static bool dispatch(event_loop_t *loop, int fd, bool in, bool out)
+{
+    bool ran = false;
+    if (in && fd < loop->nwatches && loop->watches[fd].handler) {
+        loop->watches[fd].handler(fd, loop->watches[fd].arg);
+        ran = true;
+    }
+    if (out && fd < loop->nwatches && loop->watches[fd].writer) {
+        loop->watches[fd].writer(fd, loop->watches[fd].warg);
+        ran = true;
+    }
+    return ran;
+}
+
+#if defined(__linux__)
+int event_wait(event_loop_t *loop, int timeout)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(loop->epfd, events, MAX_EVENTS, timeout);
+    if (n < 0)
+        return errno == EINTR ? 0 : -1;
+
+    int cnt = 0;
+    for (int i = 0; i < n; i++) {
+        uint32_t ev = events[i].events;
+        cnt += dispatch(loop, events[i].data.fd, ev & ~EPOLLOUT,
+                        ev & (EPOLLOUT | EPOLLERR | EPOLLHUP));
+    }
+    return cnt;
+}
+#else
+int event_wait(event_loop_t *loop, int timeout)
+{
+    struct pollfd *pfds = loop->pfds;
+    int nfds = 0;
+    for (int fd = 0; fd < loop->nwatches; fd++) {
+        event_watch_t *w = &loop->watches[fd];
+        if (w->handler || w->writer) {
+            pfds[nfds].fd = fd;
+            pfds[nfds].events =
+                (w->handler ? POLLIN : 0) | (w->writer ? POLLOUT : 0);
+            nfds++;
+        }
+    }
+
+    int n = poll(pfds, nfds, timeout);
+    if (n < 0)
+        return errno == EINTR ? 0 : -1;
+
+    int cnt = 0;
+    for (int i = 0; i < nfds; i++) {
+        short ev = pfds[i].revents;
+        if (ev)
+            cnt += dispatch(loop, pfds[i].fd, ev & ~POLLOUT,
+                            ev & (POLLOUT | POLLERR | POLLHUP));
+    }
+    return cnt;
+}
+#endif
@@ -0,0 +1,45 @@
+#ifndef LAB0_EVENT_H
+#define LAB0_EVENT_H
+
+#include <stdbool.h>
+
+/* Minimal reactor: runs a handler whenever a registered file descriptor
+ * becomes readable, or has room to write if so watched.  Backed by epoll on
+ * Linux and by poll elsewhere.  A loop must only be used by one thread at a
+ * time.
+ */
+
+typedef struct __event_loop event_loop_t;
+
+/* Function called when fd is readable, or writable */
+typedef void (*event_handler_t)(int fd, void *arg);
+
+/* Create new loop.  Return NULL on failure */
+event_loop_t *event_loop_new();
+
+/* Release loop.  Registered descriptors are left open */
+void event_loop_free(event_loop_t *loop);
+
+/* Watch fd for input.  Return false if fd cannot be watched, as with
+ * regular files, which are always readable.
+ */
+bool event_add(event_loop_t *loop, int fd, event_handler_t handler, void *arg);
+
+/* Stop watching fd for input.  Must be called before fd is closed */
+void event_del(event_loop_t *loop, int fd);
+
+/* Also watch fd for room to write, running handler each time there is */
+bool event_add_write(event_loop_t *loop,
+                     int fd,
+                     event_handler_t handler,
+                     void *arg);
+
+/* Stop watching fd for room to write.  Must be called before fd is closed */
+void event_del_write(event_loop_t *loop, int fd);
+
+/* Wait up to timeout milliseconds (-1 for no limit) and run the handlers
+ * of ready descriptors.  Return number of handlers run, or -1 on error.
+ */
+int event_wait(event_loop_t *loop, int timeout);
+
+#endif /* LAB0_EVENT_H */
@@ -42,6 +42,8 @@ typedef struct __block_element {
 
 static block_element_t *allocated = NULL;
 static size_t allocated_count = 0;
+static size_t allocated_bytes = 0;
+static size_t injected_failures = 0;
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
@@ -125,6 +127,7 @@ void *test_malloc(size_t size)
     }
 
     if (fail_allocation()) {
+        injected_failures++;
         report_event(MSG_WARN, "Malloc returning NULL");
         return NULL;
     }
@@ -152,6 +155,7 @@ void *test_malloc(size_t size)
         allocated->prev = new_block;
     allocated = new_block;
     allocated_count++;
+    allocated_bytes += size;
 
     return p;
 }
@@ -201,6 +205,7 @@ void test_free(void *p)
     if (bn)
         bn->prev = bp;
 
+    allocated_bytes -= b->payload_size;
     free(b);
     allocated_count--;
 }
@@ -221,6 +226,16 @@ size_t allocation_check()
     return allocated_count;
 }
 
+size_t allocation_bytes()
+{
+    return allocated_bytes;
+}
+
+size_t allocation_failures()
+{
+    return injected_failures;
+}
+
 /* Implementation of functions for testing */
 
 /* Set/unset cautious mode.
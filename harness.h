@@ -21,6 +21,12 @@ char *test_strdup(const char *s);
 /* Report number of allocated blocks */
 size_t allocation_check();
 
+/* Report number of payload bytes held by allocated blocks */
+size_t allocation_bytes();
+
+/* Report number of allocations made to fail as set by fail_probability */
+size_t allocation_failures();
+
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
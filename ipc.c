@@ -0,0 +1,367 @@
+/* Implementation of the binary command channel over a Unix domain socket */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ipc.h"
+
+#define LISTENQ 64
+
+/* Most requests handled as one batch */
+#define IPC_MAXBATCH 1024
+
+/* Receive buffer, with room for many frames */
+#define IPC_BUFSIZE 65536
+
+/* Bytes of replies a client may leave unread before its requests are no
+ * longer handled
+ */
+#define IPC_MAXBACKLOG (1 << 20)
+
+/* Sends never block: replies the client does not take yet stay queued on
+ * its connection, and go out once the socket has room again.
+ */
+struct __ipc_conn {
+    int fd;
+    char *in; /* IPC_BUFSIZE bytes */
+    size_t inlen;
+    char *out; /* Replies, of which the first sent bytes are sent */
+    size_t outlen, outsize, sent;
+    bool failed;  /* Reply lost, so close connection */
+    bool paused;  /* Not watched for input, while backlog is over cap */
+    bool writing; /* Waiting for room to send */
+    int fds[IPC_MAXFDS]; /* Passed with reply starting at fds_at */
+    int nfds;
+    size_t fds_at;
+};
+
+static event_loop_t *ipc_loop;
+static ipc_handler_t ipc_handler;
+static int ipc_listenfd = -1;
+static char ipc_path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+static ipc_request_t batch[IPC_MAXBATCH];
+
+static void conn_close(ipc_conn_t *c)
+{
+    event_del(ipc_loop, c->fd);
+    event_del_write(ipc_loop, c->fd);
+    close(c->fd);
+    free(c->in);
+    free(c->out);
+    free(c);
+}
+
+static bool conn_flush(ipc_conn_t *c);
+
+static void conn_append(ipc_request_t *req,
+                        int status,
+                        uint32_t value,
+                        const char *data,
+                        size_t len)
+{
+    ipc_conn_t *c = req->conn;
+    size_t need = c->outlen + sizeof(ipc_header_t) + len;
+    if (need > c->outsize) {
+        size_t size = c->outsize ? c->outsize : IPC_BUFSIZE;
+        while (size < need)
+            size *= 2;
+        char *out = realloc(c->out, size);
+        if (!out) {
+            c->failed = true;
+            return;
+        }
+        c->out = out;
+        c->outsize = size;
+    }
+
+    ipc_header_t h = {.len = len, .op = req->op, .flags = status, .arg = value};
+    memcpy(c->out + c->outlen, &h, sizeof(h));
+    if (len > 0)
+        memcpy(c->out + c->outlen + sizeof(h), data, len);
+    c->outlen = need;
+}
+
+void ipc_reply(ipc_request_t *req,
+               int status,
+               uint32_t value,
+               const char *data,
+               size_t len)
+{
+    if (status == IPC_OK && (req->flags & IPC_QUIET))
+        return;
+    conn_append(req, status, value, data, len);
+}
+
+void ipc_reply_fds(ipc_request_t *req,
+                   int status,
+                   uint32_t value,
+                   int *fds,
+                   int n)
+{
+    ipc_conn_t *c = req->conn;
+    /* Only one set of descriptors waits to be sent at a time */
+    if (c->nfds && (!conn_flush(c) || c->nfds))
+        c->failed = true;
+    c->fds_at = c->outlen;
+    c->nfds = n;
+    memcpy(c->fds, fds, n * sizeof(int));
+    conn_append(req, status, value, NULL, 0);
+}
+
+bool ipc_watch(int fd, event_handler_t handler, void *arg)
+{
+    return event_add(ipc_loop, fd, handler, arg);
+}
+
+void ipc_unwatch(int fd)
+{
+    event_del(ipc_loop, fd);
+}
+
+/* Send up to len bytes from buf without blocking, passing n descriptors
+ * along with the first.  Return number of bytes sent, or -1 on error, with
+ * errno EAGAIN if none fit.
+ */
+static ssize_t send_some(int fd, char *buf, size_t len, int *fds, int n)
+{
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(IPC_MAXFDS * sizeof(int))];
+    } ctl;
+
+    struct iovec iov = {.iov_base = buf, .iov_len = len};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+    if (n > 0) {
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = CMSG_SPACE(n * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(n * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, n * sizeof(int));
+    }
+    while (true) {
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent >= 0 || errno != EINTR)
+            return sent;
+    }
+}
+
+static void ipc_write(int fd, void *arg);
+
+/* Send as much of the replies collected for c as its socket takes, and
+ * wait for room to send the rest.  Return false on error.
+ */
+static bool conn_flush(ipc_conn_t *c)
+{
+    while (c->sent < c->outlen) {
+        /* Descriptors arrive with the first byte of the reply they belong
+         * to, so bytes ahead of it are sent on their own
+         */
+        bool pass = c->nfds && c->sent == c->fds_at;
+        size_t end = c->nfds && c->sent < c->fds_at ? c->fds_at : c->outlen;
+        ssize_t n = send_some(c->fd, c->out + c->sent, end - c->sent,
+                              c->fds, pass ? c->nfds : 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!c->writing && !event_add_write(ipc_loop, c->fd, ipc_write, c))
+                return false;
+            c->writing = true;
+            return true;
+        }
+        if (n < 0)
+            return false;
+        if (pass)
+            c->nfds = 0;
+        c->sent += n;
+    }
+    c->outlen = c->sent = 0;
+    if (c->writing)
+        event_del_write(ipc_loop, c->fd);
+    c->writing = false;
+    return true;
+}
+
+static void ipc_read(int fd, void *arg);
+
+/* Handle every complete request buffered for c, in batches, as long as its
+ * replies not sent yet stay under the cap, and send the replies
+ */
+static void conn_handle(ipc_conn_t *c)
+{
+    /* New replies go after those left, which move to the start */
+    if (c->sent > 0) {
+        c->outlen -= c->sent;
+        memmove(c->out, c->out + c->sent, c->outlen);
+        c->fds_at -= c->nfds ? c->sent : 0;
+        c->sent = 0;
+    }
+
+    size_t pos = 0;
+    bool bad = false;
+    while (!bad && c->outlen - c->sent < IPC_MAXBACKLOG) {
+        int cnt = 0;
+        while (cnt < IPC_MAXBATCH && c->inlen - pos >= sizeof(ipc_header_t)) {
+            ipc_header_t h;
+            memcpy(&h, c->in + pos, sizeof(h));
+            if (h.len > IPC_MAXPAYLOAD) {
+                bad = true; /* Could never be received whole */
+                break;
+            }
+            if (c->inlen - pos - sizeof(h) < h.len)
+                break;
+            ipc_request_t *req = &batch[cnt++];
+            req->conn = c;
+            req->op = h.op;
+            req->flags = h.flags;
+            req->queue = h.arg;
+            req->data = h.len ? c->in + pos + sizeof(h) : NULL;
+            req->len = h.len;
+            pos += sizeof(h) + h.len;
+        }
+        if (cnt == 0)
+            break;
+        ipc_handler(batch, cnt);
+    }
+    c->inlen -= pos;
+    memmove(c->in, c->in + pos, c->inlen);
+
+    if (bad || c->failed || !conn_flush(c)) {
+        conn_close(c);
+        return;
+    }
+
+    /* Client reading too slowly is not served until it catches up */
+    bool over = c->outlen - c->sent >= IPC_MAXBACKLOG;
+    if (over && !c->paused) {
+        event_del(ipc_loop, c->fd);
+        c->paused = true;
+    } else if (!over && c->paused) {
+        if (!event_add(ipc_loop, c->fd, ipc_read, c)) {
+            conn_close(c);
+            return;
+        }
+        c->paused = false;
+    }
+}
+
+/* Receive requests on connection, and handle those complete */
+static void ipc_read(int fd, void *arg)
+{
+    ipc_conn_t *c = arg;
+    ssize_t n =
+        recv(fd, c->in + c->inlen, IPC_BUFSIZE - c->inlen, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+    if (n <= 0) {
+        conn_close(c);
+        return;
+    }
+    c->inlen += n;
+    conn_handle(c);
+}
+
+/* Socket of connection has room to send again */
+static void ipc_write(int fd, void *arg)
+{
+    ipc_conn_t *c = arg;
+    if (!conn_flush(c))
+        conn_close(c);
+    else if (c->paused && c->outlen - c->sent < IPC_MAXBACKLOG)
+        conn_handle(c); /* Requests held back, and resume reading */
+}
+
+static void ipc_accept(int fd, void *arg)
+{
+    while (true) {
+        int connfd = accept(fd, NULL, NULL);
+        if (connfd < 0) {
+            if (errno == EINTR)
+                continue;
+            return; /* EAGAIN: no more pending connections */
+        }
+
+        /* Some systems pass on O_NONBLOCK, but others do not */
+        int flags = fcntl(connfd, F_GETFL);
+        ipc_conn_t *c = calloc(1, sizeof(ipc_conn_t));
+        if (flags < 0 || fcntl(connfd, F_SETFL, flags | O_NONBLOCK) < 0 ||
+            !c || !(c->in = malloc(IPC_BUFSIZE))) {
+            close(connfd);
+            free(c);
+            continue;
+        }
+        c->fd = connfd;
+        if (!event_add(ipc_loop, connfd, ipc_read, c)) {
+            c->fd = -1;
+            close(connfd);
+            free(c->in);
+            free(c);
+        }
+    }
+}
+
+/* Remove socket at path if no process listens on it any more */
+static void remove_stale(struct sockaddr_un *addr)
+{
+    struct stat st;
+    if (lstat(addr->sun_path, &st) < 0 || !S_ISSOCK(st.st_mode))
+        return;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return;
+    if (connect(fd, (struct sockaddr *) addr, sizeof(*addr)) < 0 &&
+        errno == ECONNREFUSED)
+        unlink(addr->sun_path);
+    close(fd);
+}
+
+int ipc_open(char *path, event_loop_t *loop, ipc_handler_t handler)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    ipc_close();
+    remove_stale(&addr);
+
+    int listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenfd < 0)
+        return -1;
+    ipc_loop = loop;
+    ipc_handler = handler;
+
+    /* Connections are accepted until none is pending, so never block */
+    int flags;
+    if (bind(listenfd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(listenfd, LISTENQ) < 0 ||
+        (flags = fcntl(listenfd, F_GETFL)) < 0 ||
+        fcntl(listenfd, F_SETFL, flags | O_NONBLOCK) < 0 ||
+        !event_add(loop, listenfd, ipc_accept, NULL)) {
+        int err = errno;
+        close(listenfd);
+        errno = err;
+        return -1;
+    }
+    ipc_listenfd = listenfd;
+    strcpy(ipc_path, addr.sun_path);
+    return listenfd;
+}
+
+void ipc_close()
+{
+    if (ipc_listenfd < 0)
+        return;
+    event_del(ipc_loop, ipc_listenfd);
+    close(ipc_listenfd);
+    unlink(ipc_path);
+    ipc_listenfd = -1;
+}
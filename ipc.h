@@ -0,0 +1,111 @@
+#ifndef LAB0_IPC_H
+#define LAB0_IPC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "event.h"
+
+/* Binary command channel over a Unix domain socket, for drivers running on
+ * the same host.  Each request and reply is a frame: a header, followed by
+ * len bytes of payload.  Integers are in native byte order, as both ends
+ * share a host.  String payloads are sent with their terminating null
+ * character.
+ *
+ * Every frame received at once is decoded before any is handled, and the
+ * replies to them go out together, as far as the socket takes them.  A
+ * client leaving too many replies unread is not served until it reads them.
+ */
+
+typedef struct {
+    uint32_t len;  /* Bytes of payload following the header */
+    uint8_t op;    /* Operation, echoed in reply */
+    uint8_t flags; /* Request: IPC_QUIET.  Reply: status */
+    uint16_t pad;  /* Zero */
+    uint32_t arg;  /* Request: queue ID.  Reply: result value */
+} ipc_header_t;
+
+/* Largest payload of a frame */
+#define IPC_MAXPAYLOAD 4096
+
+/* Operations */
+enum {
+    IPC_SYNC = 0, /* Do nothing, but always reply */
+    IPC_NEW,      /* Create queue, replying its ID */
+    IPC_FREE,     /* Delete queue */
+    IPC_IH,       /* Insert payload string at head */
+    IPC_IT,       /* Insert payload string at tail */
+    IPC_RH,       /* Remove head, replying its string */
+    IPC_RT,       /* Remove tail, replying its string */
+    IPC_SIZE,     /* Reply number of elements */
+    IPC_REVERSE,
+    IPC_SORT,
+    IPC_RING, /* Create ring feeding tail, replying its size and descriptors */
+};
+
+/* Request flag: reply only if the operation does not succeed */
+#define IPC_QUIET 1
+
+/* Reply status */
+enum {
+    IPC_OK = 0,
+    IPC_FAILED, /* Operation failed, as removing from an empty queue */
+    IPC_ERROR,  /* Invalid request or queue ID, or operation crashed */
+};
+
+typedef struct __ipc_conn ipc_conn_t;
+
+/* Request, decoded in place from the buffer of its connection */
+typedef struct {
+    ipc_conn_t *conn;
+    int op;
+    int flags;
+    uint32_t queue;
+    char *data; /* Payload, or NULL if empty */
+    size_t len;
+} ipc_request_t;
+
+/* Function handling n requests, which must reply to each with ipc_reply,
+ * in order
+ */
+typedef void (*ipc_handler_t)(ipc_request_t *reqs, int n);
+
+/* Listen on socket at path, serving connections from loop.  A stale socket
+ * left at path is replaced.  Return listening descriptor, or -1 on failure.
+ */
+int ipc_open(char *path, event_loop_t *loop, ipc_handler_t handler);
+
+/* Stop listening, and remove the socket.  Connections already accepted are
+ * still served.
+ */
+void ipc_close();
+
+/* Queue reply to req with status, result value, and optional payload */
+void ipc_reply(ipc_request_t *req,
+               int status,
+               uint32_t value,
+               const char *data,
+               size_t len);
+
+/* Most descriptors passed with one reply */
+#define IPC_MAXFDS 2
+
+/* Queue reply to req with status and result value, passing n descriptors
+ * along with it.  The reply is sent even if req is quiet.
+ */
+void ipc_reply_fds(ipc_request_t *req,
+                   int status,
+                   uint32_t value,
+                   int *fds,
+                   int n);
+
+/* Watch fd on the loop serving the channel, as for resources created by its
+ * requests
+ */
+bool ipc_watch(int fd, event_handler_t handler, void *arg);
+
+/* Stop watching fd.  Must be called before fd is closed */
+void ipc_unwatch(int fd);
+
+#endif /* LAB0_IPC_H */
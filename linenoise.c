@@ -105,13 +105,17 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <unistd.h>
 
@@ -119,6 +123,13 @@
 
 #define LINENOISE_DEFAULT_HISTORY_MAX_LEN 100
 #define LINENOISE_MAX_LINE 4096
+#define LINENOISE_MAX_QUERY 256
+/* Returned by line_edit_key() while the line is not complete */
+#define LINE_EDIT_MORE (-2)
+/* Hashed trigrams indexing the history for search */
+#define LINENOISE_INDEX_BUCKETS 65536
+/* History files at least this large are mapped rather than read */
+#define LINENOISE_HISTORY_MMAP_SIZE 65536
 
 static char *unsupported_term[] = {"dumb", "cons25", "emacs", NULL};
 static line_completion_callback_t *completion_callback = NULL;
@@ -133,7 +144,13 @@ static bool mlmode = false; /* Multi line mode. Default is single line. */
 static bool atexit_registered = false; /* Register atexit just 1 time. */
 static int history_max_len = LINENOISE_DEFAULT_HISTORY_MAX_LEN;
 static int history_len = 0;
-static char **history = NULL;
+static int history_start = 0; /* Slot of the oldest entry */
+static char **history = NULL; /* Circular buffer of history_max_len slots */
+static uint32_t history_seq = 0; /* Sequence number of the next entry */
+/* Journal the history is appended to, and how many lines it holds */
+static char *journal_name = NULL;
+static int journal_fd = -1;
+static int journal_lines = 0;
 
 /* The line_state structure represents the state during line editing.
  * We pass this state to functions implementing specific editing
@@ -147,11 +164,26 @@ struct line_state {
     const char *prompt; /* Prompt to display. */
     size_t plen;        /* Prompt length. */
     size_t pos;         /* Current cursor position. */
-    size_t oldpos;      /* Previous refresh cursor position. */
     size_t len;         /* Current edited line length. */
     size_t cols;        /* Number of columns in terminal. */
-    size_t maxrows;     /* Maximum num of rows used so far (multiline mode) */
     int history_index;  /* The history index we are currently editing. */
+    /* Tab completion, offering option 'completion' of 'lc' */
+    bool completing;
+    line_completions_t lc;
+    size_t completion;
+    /* Escape sequence read so far, without the escape */
+    bool escaping;
+    char seq[5];
+    int seqlen;
+    bool pasting; /* Reading a bracketed paste */
+    /* Incremental reverse history search, started with ctrl-r */
+    bool searching;
+    char query[LINENOISE_MAX_QUERY]; /* Text searched for */
+    size_t qlen;
+    int match;              /* History index of the entry shown, or -1 */
+    char *saved;            /* Line edited before the search */
+    const char *oldprompt;  /* Prompt restored after the search */
+    char sprompt[LINENOISE_MAX_QUERY + 32]; /* Prompt shown while searching */
 };
 
 enum KEY_ACTION {
@@ -162,6 +194,7 @@ enum KEY_ACTION {
     CTRL_D = 4,     /* Ctrl-d */
     CTRL_E = 5,     /* Ctrl-e */
     CTRL_F = 6,     /* Ctrl-f */
+    CTRL_G = 7,     /* Ctrl-g */
     CTRL_H = 8,     /* Ctrl-h */
     TAB = 9,        /* Tab */
     CTRL_K = 11,    /* Ctrl+k */
@@ -169,6 +202,7 @@ enum KEY_ACTION {
     ENTER = 13,     /* Enter */
     CTRL_N = 14,    /* Ctrl-n */
     CTRL_P = 16,    /* Ctrl-p */
+    CTRL_R = 18,    /* Ctrl-r */
     CTRL_T = 20,    /* Ctrl-t */
     CTRL_U = 21,    /* Ctrl+u */
     CTRL_W = 23,    /* Ctrl+w */
@@ -187,11 +221,9 @@ FILE *lndebug_fp = NULL;
     do {                                                                       \
         if (lndebug_fp == NULL) {                                              \
             lndebug_fp = fopen("/tmp/lndebug.txt", "a");                       \
-            fprintf(                                                           \
-                lndebug_fp,                                                    \
-                "[%d %d %d] p: %d, rows: %d, rpos: %d, max: %d, oldmax: %d\n", \
-                (int) l->len, (int) l->pos, (int) l->oldpos, plen, rows, rpos, \
-                (int) l->maxrows, old_rows);                                   \
+            fprintf(lndebug_fp, "[%d %d] shown: %d, end: %d, at: %d\n",     \
+                    (int) l->len, (int) l->pos, shown_text.len,                \
+                    (int) shown_end, (int) shown_pos);                         \
         }                                                                      \
         fprintf(lndebug_fp, ", " __VA_ARGS__);                                 \
         fflush(lndebug_fp);                                                    \
@@ -270,10 +302,15 @@ static int enable_raw_mode(int fd)
     raw.c_cc[VMIN] = 1;
     raw.c_cc[VTIME] = 0; /* 1 byte, no timer */
 
-    /* put terminal in raw mode after flushing */
-    if (tcsetattr(fd, TCSAFLUSH, &raw) < 0)
+    /* Put terminal in raw mode once output is drained.  Keys typed ahead are
+     * kept, as raw mode is left and entered again around other output.
+     */
+    if (tcsetattr(fd, TCSADRAIN, &raw) < 0)
         goto fatal;
     rawmode = true;
+    /* Have pasted text bracketed, so it is not taken for typed keys */
+    if (write(STDOUT_FILENO, "\x1b[?2004h", 8) == -1) {
+    }
     return 0;
 
 fatal:
@@ -284,7 +321,9 @@ fatal:
 static void disable_raw_mode(int fd)
 {
     /* Don't even check the return value as it's too late. */
-    if (rawmode && tcsetattr(fd, TCSAFLUSH, &orig_termios) != -1)
+    if (rawmode && write(STDOUT_FILENO, "\x1b[?2004l", 8) == -1) {
+    }
+    if (rawmode && tcsetattr(fd, TCSADRAIN, &orig_termios) != -1)
         rawmode = false;
 }
 
@@ -386,72 +425,79 @@ static void free_completions(line_completions_t *lc)
     free(lc->cvec);
 }
 
-/* This is an helper function for line_edit() and is called when the
+/* Show the completion option being offered, or the original line once
+ * past the last option.
+ */
+static void complete_show(struct line_state *ls)
+{
+    if (ls->completion < ls->lc.len) {
+        char *buf = ls->buf;
+        size_t len = ls->len, pos = ls->pos;
+
+        ls->len = ls->pos = strlen(ls->lc.cvec[ls->completion]);
+        ls->buf = ls->lc.cvec[ls->completion];
+        refresh_line(ls);
+        ls->len = len;
+        ls->pos = pos;
+        ls->buf = buf;
+    } else {
+        refresh_line(ls);
+    }
+}
+
+static void complete_end(struct line_state *ls)
+{
+    free_completions(&ls->lc);
+    ls->completing = false;
+}
+
+/* This is an helper function for line_edit_key() and is called when the
  * user types the <tab> key in order to complete the string currently in the
- * input.
+ * input, and for every key typed after it until the completion is over.
  *
  * The state of the editing is encapsulated into the pointed line_state
  * structure as described in the structure definition.
+ *
+ * Return the key to be handled as usual, or 0 if it was consumed.
  */
-static int complete_line(struct line_state *ls)
+static int complete_line(struct line_state *ls, char c)
 {
-    line_completions_t lc = {0, NULL};
-    char c = 0;
-
-    completion_callback(ls->buf, &lc);
-    if (lc.len == 0) {
-        line_beep();
-    } else {
-        bool stop = false;
-        size_t i = 0;
-
-        while (!stop) {
-            /* Show completion or original buffer */
-            if (i < lc.len) {
-                struct line_state saved = *ls;
-
-                ls->len = ls->pos = strlen(lc.cvec[i]);
-                ls->buf = lc.cvec[i];
-                refresh_line(ls);
-                ls->len = saved.len;
-                ls->pos = saved.pos;
-                ls->buf = saved.buf;
-            } else {
-                refresh_line(ls);
-            }
-
-            int nread = read(ls->ifd, &c, 1);
-            if (nread <= 0) {
-                free_completions(&lc);
-                return -1;
-            }
-
-            switch (c) {
-            case 9: /* tab */
-                i = (i + 1) % (lc.len + 1);
-                if (i == lc.len)
-                    line_beep();
-                break;
-            case 27: /* escape */
-                /* Re-show original buffer */
-                if (i < lc.len)
-                    refresh_line(ls);
-                stop = true;
-                break;
-            default:
-                /* Update buffer and return */
-                if (i < lc.len) {
-                    int nwritten =
-                        snprintf(ls->buf, ls->buflen, "%s", lc.cvec[i]);
-                    ls->len = ls->pos = nwritten;
-                }
-                stop = true;
-                break;
-            }
+    if (!ls->completing) {
+        ls->lc = (line_completions_t){0, NULL};
+        completion_callback(ls->buf, &ls->lc);
+        if (ls->lc.len == 0) {
+            line_beep();
+            free_completions(&ls->lc);
+            return 0;
         }
+        ls->completing = true;
+        ls->completion = 0;
+        complete_show(ls);
+        return 0;
     }
 
-    free_completions(&lc);
+    switch (c) {
+    case 9: /* tab */
+        ls->completion = (ls->completion + 1) % (ls->lc.len + 1);
+        if (ls->completion == ls->lc.len)
+            line_beep();
+        complete_show(ls);
+        return 0;
+    case 27: /* escape */
+        /* Re-show original buffer */
+        if (ls->completion < ls->lc.len)
+            refresh_line(ls);
+        break;
+    default:
+        /* Update buffer and return */
+        if (ls->completion < ls->lc.len) {
+            int nwritten = snprintf(ls->buf, ls->buflen, "%s",
+                                    ls->lc.cvec[ls->completion]);
+            ls->len = ls->pos = nwritten;
+        }
+        break;
+    }
+    complete_end(ls);
     return c; /* Return last read character */
 }
 
@@ -517,6 +563,10 @@ static void ab_init(struct abuf *ab)
 
 static void ab_append(struct abuf *ab, const char *s, int len)
 {
+    /* realloc() to zero bytes might free the buffer */
+    if (len == 0)
+        return;
+
     char *new = realloc(ab->b, ab->len + len);
     if (!new)
         return;
@@ -532,16 +582,18 @@ static inline void ab_free(struct abuf *ab)
 }
 
 /* Helper of refresh_single_line() and refresh_multi_Line() to show hints
- * to the right of the prompt.
+ * to the right of the prompt.  Return the number of columns they take.
  */
-void refresh_show_hints(struct abuf *ab, struct line_state *l, int plen)
+int refresh_show_hints(struct abuf *ab, struct line_state *l, int plen)
 {
+    int hintlen = 0;
+
     if (hints_callback && plen + l->len < l->cols) {
         int color = -1, bold = 0;
         char *hint = hints_callback(l->buf, &color, &bold);
         if (hint) {
             char seq[64];
-            int hintlen = strlen(hint);
+            hintlen = strlen(hint);
             int hintmaxlen = l->cols - (plen + l->len);
             if (hintlen > hintmaxlen)
                 hintlen = hintmaxlen;
@@ -560,6 +612,112 @@ void refresh_show_hints(struct abuf *ab, struct line_state *l, int plen)
                 free_hints_callback(hint);
         }
     }
+    return hintlen;
+}
+
+/* What the last refresh left on the terminal: the prompt and the visible
+ * part of the line, the hint shown after them, the columns they take, and
+ * the cursor position within them.  The next refresh only sends what differs.
+ */
+static struct abuf shown_text, shown_hint;
+static size_t shown_end, shown_pos;
+
+/* Text of a bracketed paste not inserted yet.  A paste of several lines is
+ * handed out one line per call to linenoise(), so each runs as a command.
+ */
+static char *paste_buf;
+static size_t paste_len, paste_pos, paste_size;
+static size_t paste_from; /* Where the paste being read starts */
+
+/* Forget what is on the terminal, as when the line starts or the screen is
+ * cleared, so the next refresh draws everything.
+ */
+static void refresh_reset(void)
+{
+    shown_text.len = shown_hint.len = 0;
+    shown_end = shown_pos = 0;
+}
+
+/* Append to ab the moves taking the cursor from offset 'from' to offset 'to'
+ * of the rendered line, which wraps every l->cols columns in multi line mode.
+ */
+static void refresh_move(struct abuf *ab,
+                         struct line_state *l,
+                         size_t from,
+                         size_t to)
+{
+    char seq[64];
+    size_t cols = mlmode ? l->cols : SIZE_MAX;
+    size_t row = from / cols, row2 = to / cols, col = to % cols;
+
+    if (from == to)
+        return;
+    if (row > row2) {
+        snprintf(seq, 64, "\x1b[%dA", (int) (row - row2));
+        ab_append(ab, seq, strlen(seq));
+    } else if (row2 > row) {
+        snprintf(seq, 64, "\x1b[%dB", (int) (row2 - row));
+        ab_append(ab, seq, strlen(seq));
+    }
+    /* Columns are counted from the left edge, as the cursor may be waiting
+     * to wrap after the last column.
+     */
+    if (col)
+        snprintf(seq, 64, "\r\x1b[%dC", (int) col);
+    else
+        snprintf(seq, 64, "\r");
+    ab_append(ab, seq, strlen(seq));
+}
+
+/* Update the terminal to show 'text' followed by 'hint', which is
+ * 'hintcols' columns wide, with the cursor at offset 'pos' of 'text'.
+ *
+ * Compared to what the last refresh showed, only the bytes from the first
+ * difference on are written, and the screen is only erased where the new
+ * line is shorter.  Typing at the end of the line thus sends one byte, and
+ * moving the cursor sends only the move.
+ */
+static void refresh_diff(struct line_state *l,
+                         struct abuf *text,
+                         struct abuf *hint,
+                         size_t hintcols,
+                         size_t pos)
+{
+    struct abuf ab;
+    size_t at = shown_pos;
+    int same = 0;
+
+    while (same < text->len && same < shown_text.len &&
+           text->b[same] == shown_text.b[same])
+        same++;
+
+    ab_init(&ab);
+    if (same < text->len || same < shown_text.len ||
+        hint->len != shown_hint.len ||
+        (hint->len && memcmp(hint->b, shown_hint.b, hint->len))) {
+        refresh_move(&ab, l, at, same);
+        int written = ab.len;
+        ab_append(&ab, text->b + same, text->len - same);
+        ab_append(&ab, hint->b, hint->len);
+        at = text->len + hintcols;
+        /* Leave the last column written, so rows below can be reached */
+        if (mlmode && ab.len > written && at % l->cols == 0)
+            ab_append(&ab, "\n\r", 2);
+        if (at < shown_end) {
+            lndebug("erase %d", (int) (shown_end - at));
+            ab_append(&ab, mlmode ? "\x1b[0J" : "\x1b[0K", 4);
+        }
+        shown_end = at;
+        shown_text.len = shown_hint.len = 0;
+        ab_append(&shown_text, text->b, text->len);
+        ab_append(&shown_hint, hint->b, hint->len);
+    }
+    refresh_move(&ab, l, at, pos);
+    shown_pos = pos;
+
+    if (ab.len && write(l->ofd, ab.b, ab.len) == -1) {
+    } /* Can't recover from write error. */
+    ab_free(&ab);
 }
 
 /* Single line low level line refresh.
@@ -569,13 +727,11 @@ void refresh_show_hints(struct abuf *ab, struct line_state *l, int plen)
  */
 static void refresh_single_line(struct line_state *l)
 {
-    char seq[64];
     size_t plen = strlen(l->prompt);
-    int fd = l->ofd;
     char *buf = l->buf;
     size_t len = l->len;
     size_t pos = l->pos;
-    struct abuf ab;
+    struct abuf text, hint;
 
     while ((plen + pos) >= l->cols) {
         buf++;
@@ -585,29 +741,21 @@ static void refresh_single_line(struct line_state *l)
     while (plen + len > l->cols)
         len--;
 
-    ab_init(&ab);
-    /* Cursor to left edge */
-    snprintf(seq, 64, "\r");
-    ab_append(&ab, seq, strlen(seq));
-    /* Write the prompt and the current buffer content */
-    ab_append(&ab, l->prompt, strlen(l->prompt));
+    ab_init(&text);
+    ab_init(&hint);
+    /* The prompt and the visible part of the buffer */
+    ab_append(&text, l->prompt, plen);
     if (maskmode) {
         while (len--)
-            ab_append(&ab, "*", 1);
+            ab_append(&text, "*", 1);
     } else {
-        ab_append(&ab, buf, len);
+        ab_append(&text, buf, len);
     }
     /* Show hits if any. */
-    refresh_show_hints(&ab, l, plen);
-    /* Erase to right */
-    snprintf(seq, 64, "\x1b[0K");
-    ab_append(&ab, seq, strlen(seq));
-    /* Move cursor to original position. */
-    snprintf(seq, 64, "\r\x1b[%dC", (int) (pos + plen));
-    ab_append(&ab, seq, strlen(seq));
-    if (write(fd, ab.b, ab.len) == -1) {
-    } /* Can't recover from write error. */
-    ab_free(&ab);
+    int hintcols = refresh_show_hints(&hint, l, plen);
+    refresh_diff(l, &text, &hint, hintcols, plen + pos);
+    ab_free(&text);
+    ab_free(&hint);
 }
 
 /* Multi line low level line refresh.
@@ -617,95 +765,25 @@ static void refresh_single_line(struct line_state *l)
  */
 static void refresh_multi_Line(struct line_state *l)
 {
-    char seq[64];
     int plen = strlen(l->prompt);
-    int rows =
-        (plen + l->len + l->cols - 1) / l->cols; /* rows used by current buf. */
-    int rpos =
-        (plen + l->oldpos + l->cols) / l->cols; /* cursor relative row. */
-    int rpos2;                                  /* rpos after refresh. */
-    int col; /* colum position, zero-based. */
-    int old_rows = l->maxrows;
-    int fd = l->ofd;
-    struct abuf ab;
-
-    /* Update maxrows if needed. */
-    if (rows > (int) l->maxrows)
-        l->maxrows = rows;
-
-    /* First step: clear all the lines used before. To do so start by
-     * going to the last row. */
-    ab_init(&ab);
-    if (old_rows - rpos > 0) {
-        lndebug("go down %d", old_rows - rpos);
-        snprintf(seq, 64, "\x1b[%dB", old_rows - rpos);
-        ab_append(&ab, seq, strlen(seq));
-    }
-
-    /* Now for every row clear it, go up. */
-    for (int j = 0; j < old_rows - 1; j++) {
-        lndebug("clear+up");
-        snprintf(seq, 64, "\r\x1b[0K\x1b[1A");
-        ab_append(&ab, seq, strlen(seq));
-    }
-
-    /* Clean the top line. */
-    lndebug("clear");
-    snprintf(seq, 64, "\r\x1b[0K");
-    ab_append(&ab, seq, strlen(seq));
+    struct abuf text, hint;
 
-    /* Write the prompt and the current buffer content */
-    ab_append(&ab, l->prompt, strlen(l->prompt));
+    ab_init(&text);
+    ab_init(&hint);
+    /* The prompt and the current buffer content, wrapped by the terminal */
+    ab_append(&text, l->prompt, plen);
     if (maskmode) {
         for (unsigned int i = 0; i < l->len; i++)
-            ab_append(&ab, "*", 1);
+            ab_append(&text, "*", 1);
     } else {
-        ab_append(&ab, l->buf, l->len);
+        ab_append(&text, l->buf, l->len);
     }
-
     /* Show hits if any. */
-    refresh_show_hints(&ab, l, plen);
-
-    /* If we are at the very end of the screen with our prompt, we need to
-     * emit a newline and move the prompt to the first column.
-     */
-    if (l->pos && l->pos == l->len && (l->pos + plen) % l->cols == 0) {
-        lndebug("<newline>");
-        ab_append(&ab, "\n", 1);
-        snprintf(seq, 64, "\r");
-        ab_append(&ab, seq, strlen(seq));
-        rows++;
-        if (rows > (int) l->maxrows)
-            l->maxrows = rows;
-    }
-
-    /* Move cursor to right position. */
-    rpos2 =
-        (plen + l->pos + l->cols) / l->cols; /* current cursor relative row. */
-    lndebug("rpos2 %d", rpos2);
-
-    /* Go up till we reach the expected positon. */
-    if (rows - rpos2 > 0) {
-        lndebug("go-up %d", rows - rpos2);
-        snprintf(seq, 64, "\x1b[%dA", rows - rpos2);
-        ab_append(&ab, seq, strlen(seq));
-    }
-
-    /* Set column. */
-    col = (plen + (int) l->pos) % (int) l->cols;
-    lndebug("set col %d", 1 + col);
-    if (col)
-        snprintf(seq, 64, "\r\x1b[%dC", col);
-    else
-        snprintf(seq, 64, "\r");
-    ab_append(&ab, seq, strlen(seq));
-
-    lndebug("\n");
-    l->oldpos = l->pos;
-
-    if (write(fd, ab.b, ab.len) == -1) {
-    } /* Can't recover from write error. */
-    ab_free(&ab);
+    int hintcols = refresh_show_hints(&hint, l, plen);
+    lndebug("len %d pos %d", (int) l->len, (int) l->pos);
+    refresh_diff(l, &text, &hint, hintcols, plen + l->pos);
+    ab_free(&text);
+    ab_free(&hint);
 }
 
 /* Calls the two low level functions refresh_single_line() or
@@ -726,32 +804,49 @@ static void refresh_line(struct line_state *l)
 int line_edit_insert(struct line_state *l, char c)
 {
     if (l->len < l->buflen) {
-        if (l->len == l->pos) {
-            l->buf[l->pos] = c;
-            l->pos++;
-            l->len++;
-            l->buf[l->len] = '\0';
-            if ((!mlmode && l->plen + l->len < l->cols && !hints_callback)) {
-                /* Avoid a full update of the line in the
-                 * trivial case. */
-                char d = maskmode ? '*' : c;
-                if (write(l->ofd, &d, 1) == -1)
-                    return -1;
-            } else {
-                refresh_line(l);
-            }
-        } else {
-            memmove(l->buf + l->pos + 1, l->buf + l->pos, l->len - l->pos);
-            l->buf[l->pos] = c;
-            l->len++;
-            l->pos++;
-            l->buf[l->len] = '\0';
-            refresh_line(l);
-        }
+        memmove(l->buf + l->pos + 1, l->buf + l->pos, l->len - l->pos);
+        l->buf[l->pos] = c;
+        l->len++;
+        l->pos++;
+        l->buf[l->len] = '\0';
+        /* Only the new character is sent in the trivial case. */
+        refresh_line(l);
     }
     return 0;
 }
 
+/* Insert pasted text at the cursor up to its next line break, refreshing
+ * once.  Return true if a line break was reached, which ends the line as if
+ * enter was pressed.
+ */
+static bool line_edit_paste(struct line_state *l)
+{
+    bool eol = false;
+
+    while (paste_pos < paste_len) {
+        unsigned char c = paste_buf[paste_pos++];
+        if (c == '\r' || c == '\n') {
+            if (c == '\r' && paste_pos < paste_len &&
+                paste_buf[paste_pos] == '\n')
+                paste_pos++;
+            eol = true;
+            break;
+        }
+        if (c == '\t')
+            c = ' ';
+        /* Other control characters would not take one column each. */
+        if (c < ' ' || c == BACKSPACE || l->len == l->buflen)
+            continue;
+        memmove(l->buf + l->pos + 1, l->buf + l->pos, l->len - l->pos);
+        l->buf[l->pos++] = c;
+        l->buf[++l->len] = '\0';
+    }
+    if (paste_pos == paste_len)
+        paste_pos = paste_len = 0;
+    refresh_line(l);
+    return eol;
+}
+
 /* Move cursor on the left. */
 void line_edit_move_left(struct line_state *l)
 {
@@ -788,6 +883,152 @@ void line_edit_move_end(struct line_state *l)
     }
 }
 
+/* Slot of the history entry 'index' entries back from the newest one. */
+static char **history_slot(int index)
+{
+    int i = history_start + history_len - 1 - index;
+    return &history[i >= history_max_len ? i - history_max_len : i];
+}
+
+/* Remove the newest history entry. */
+static void history_pop(void)
+{
+    free(*history_slot(0));
+    history_len--;
+    history_seq--;
+}
+
+/* ============================= History index ============================== */
+
+/* Every history entry has a sequence number, counting up as entries are
+ * added, so the entry 'index' entries back from the newest one has number
+ * history_seq - 1 - index.  Each trigram of an entry is hashed to a bucket
+ * listing the numbers of the entries containing one of its trigrams, in
+ * ascending order.
+ *
+ * Entries evicted from the history stay listed until their bucket next
+ * grows.  Hash collisions and entries edited since they were listed only
+ * add candidates, as the search checks each candidate against the entry
+ * itself.
+ */
+typedef struct {
+    uint32_t *seqs;
+    int len, cap;
+} history_bucket_t;
+
+static history_bucket_t *history_index = NULL;
+
+static unsigned trigram_hash(const char *s)
+{
+    uint32_t t = (uint8_t) s[0] | (uint8_t) s[1] << 8 | (uint8_t) s[2] << 16;
+    return (t * 2654435761u) >> 16; /* 16 bits: LINENOISE_INDEX_BUCKETS */
+}
+
+/* Position of the first number in 'b' greater than 'seq'. */
+static int bucket_upper(history_bucket_t *b, uint32_t seq)
+{
+    int lo = 0, hi = b->len;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (b->seqs[mid] <= seq)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void bucket_add(history_bucket_t *b, uint32_t seq)
+{
+    /* Edited entries keep their number, so may not come last */
+    int pos = b->len;
+    if (pos > 0 && b->seqs[pos - 1] >= seq) {
+        pos = bucket_upper(b, seq);
+        if (pos > 0 && b->seqs[pos - 1] == seq)
+            return;
+    }
+
+    if (b->len == b->cap) {
+        /* Drop numbers of evicted entries before growing */
+        uint32_t oldest = history_seq - history_len;
+        int stale = oldest ? bucket_upper(b, oldest - 1) : 0;
+        if (stale > 0) {
+            memmove(b->seqs, b->seqs + stale,
+                    (b->len - stale) * sizeof(uint32_t));
+            b->len -= stale;
+            pos -= stale;
+        } else {
+            int cap = b->cap ? b->cap * 2 : 4;
+            uint32_t *seqs = realloc(b->seqs, cap * sizeof(uint32_t));
+            if (!seqs)
+                return;
+            b->seqs = seqs;
+            b->cap = cap;
+        }
+    }
+    memmove(b->seqs + pos + 1, b->seqs + pos,
+            (b->len - pos) * sizeof(uint32_t));
+    b->seqs[pos] = seq;
+    b->len++;
+}
+
+/* List the history entry 'index' under each of its trigrams. */
+static void history_index_add(int index)
+{
+    if (!history_index) {
+        history_index =
+            calloc(LINENOISE_INDEX_BUCKETS, sizeof(history_bucket_t));
+        if (!history_index)
+            return;
+    }
+    const char *entry = *history_slot(index);
+    uint32_t seq = history_seq - 1 - index;
+    for (size_t i = 0; entry[i] && entry[i + 1] && entry[i + 2]; i++)
+        bucket_add(&history_index[trigram_hash(entry + i)], seq);
+}
+
+static void free_history_index(void)
+{
+    if (history_index) {
+        for (int i = 0; i < LINENOISE_INDEX_BUCKETS; i++)
+            free(history_index[i].seqs);
+        free(history_index);
+        history_index = NULL;
+    }
+}
+
+/* Return the index of the newest history entry containing 'query', at
+ * history index 'from' or older, or -1 if there is none.  Queries with a
+ * trigram only look at the entries listed under their rarest trigram.
+ */
+static int history_search(const char *query, size_t qlen, int from)
+{
+    if (from >= history_len)
+        return -1;
+    if (qlen < 3 || !history_index) {
+        for (int i = from; i < history_len; i++) {
+            if (strstr(*history_slot(i), query))
+                return i;
+        }
+        return -1;
+    }
+
+    history_bucket_t *best = NULL;
+    for (size_t i = 0; i + 3 <= qlen; i++) {
+        history_bucket_t *b = &history_index[trigram_hash(query + i)];
+        if (!best || b->len < best->len)
+            best = b;
+    }
+    uint32_t oldest = history_seq - history_len;
+    for (int i = bucket_upper(best, history_seq - 1 - from) - 1;
+         i >= 0 && best->seqs[i] >= oldest; i--) {
+        int index = history_seq - 1 - best->seqs[i];
+        if (strstr(*history_slot(index), query))
+            return index;
+    }
+    return -1;
+}
+
 /* Substitute the currently edited line with the next or previous history
  * entry as specified by 'dir'.
  */
@@ -797,8 +1038,11 @@ void line_edit_history_next(struct line_state *l, int dir)
     if (history_len > 1) {
         /* Update the current history entry before to
          * overwrite it with the next one. */
-        free(history[history_len - 1 - l->history_index]);
-        history[history_len - 1 - l->history_index] = strdup(l->buf);
+        char **slot = history_slot(l->history_index);
+        free(*slot);
+        *slot = strdup(l->buf);
+        if (*slot)
+            history_index_add(l->history_index);
         /* Show the new entry */
         l->history_index += (dir == LINENOISE_HISTORY_PREV) ? 1 : -1;
         if (l->history_index < 0) {
@@ -808,7 +1052,7 @@ void line_edit_history_next(struct line_state *l, int dir)
             l->history_index = history_len - 1;
             return;
         }
-        strncpy(l->buf, history[history_len - 1 - l->history_index], l->buflen);
+        strncpy(l->buf, *history_slot(l->history_index), l->buflen);
         l->buf[l->buflen - 1] = '\0';
         l->len = l->pos = strlen(l->buf);
         refresh_line(l);
@@ -888,237 +1132,452 @@ static void line_edit_next_word(struct line_state *l)
     refresh_line(l);
 }
 
-/* This function is the core of the line editing capability of linenoise.
- * It expects 'fd' to be already in "raw mode" so that every key pressed
- * will be returned ASAP to read().
- *
- * The resulting string is put into 'buf' when the user type enter, or
- * when ctrl+d is typed.
- *
- * The function returns the length of the current buffer.
+/* Show the search prompt and the entry found by the incremental search. */
+static void search_refresh(struct line_state *l)
+{
+    snprintf(l->sprompt, sizeof(l->sprompt), "(%sreverse-i-search)`%s': ",
+             l->match < 0 && l->qlen ? "failed " : "", l->query);
+    l->prompt = l->sprompt;
+    l->plen = strlen(l->sprompt);
+    refresh_line(l);
+}
+
+/* Put the history entry 'index' in the buffer, cursor on the match. */
+static void search_show(struct line_state *l, int index)
+{
+    strncpy(l->buf, *history_slot(index), l->buflen);
+    l->buf[l->buflen - 1] = '\0';
+    l->len = strlen(l->buf);
+    char *hit = strstr(l->buf, l->query);
+    l->pos = hit ? (size_t) (hit - l->buf) : l->len;
+    l->match = index;
+}
+
+/* Search the history for the query, from history index 'from' back. A
+ * failed search keeps showing the last entry found, as readline does.
  */
-static int line_edit(int stdin_fd,
-                     int stdout_fd,
-                     char *buf,
-                     size_t buflen,
-                     const char *prompt)
+static void search_update(struct line_state *l, int from)
 {
-    struct line_state l;
+    int index = l->qlen ? history_search(l->query, l->qlen, from) : -1;
+    if (index >= 0) {
+        search_show(l, index);
+    } else {
+        if (l->qlen)
+            line_beep();
+        l->match = -1;
+    }
+    search_refresh(l);
+}
+
+/* Start an incremental reverse search of the history. */
+static void search_start(struct line_state *l)
+{
+    l->saved = strdup(l->buf);
+    if (!l->saved)
+        return;
+    l->searching = true;
+    l->query[0] = '\0';
+    l->qlen = 0;
+    l->match = -1;
+    l->oldprompt = l->prompt;
+    search_refresh(l);
+}
+
+/* Leave the search, keeping the entry found or restoring the line edited
+ * before it.
+ */
+static void search_end(struct line_state *l, bool keep)
+{
+    if (!keep) {
+        strncpy(l->buf, l->saved, l->buflen);
+        l->buf[l->buflen - 1] = '\0';
+        l->len = l->pos = strlen(l->buf);
+    }
+    free(l->saved);
+    l->searching = false;
+    l->prompt = l->oldprompt;
+    l->plen = strlen(l->prompt);
+    refresh_line(l);
+}
+
+/* Handle key 'c' typed while searching. Returns 0 if the key was consumed,
+ * otherwise the search is over and the key must be handled as usual.
+ */
+static int search_key(struct line_state *l, char c)
+{
+    switch (c) {
+    case CTRL_R: /* ctrl-r, next older entry found */
+        search_update(l, l->match >= 0 ? l->match + 1 : 1);
+        return 0;
+    case CTRL_G: /* ctrl-g or ctrl-c, give up the search */
+    case CTRL_C:
+        search_end(l, false);
+        return 0;
+    case BACKSPACE:
+    case CTRL_H:
+        if (l->qlen > 0)
+            l->query[--l->qlen] = '\0';
+        /* The current line itself, history index 0, is never searched */
+        search_update(l, 1);
+        return 0;
+    default:
+        if (isprint((unsigned char) c) && l->qlen + 1 < LINENOISE_MAX_QUERY) {
+            l->query[l->qlen++] = c;
+            l->query[l->qlen] = '\0';
+            /* The entry found so far may still match, while a query that
+             * failed only fails again when extended
+             */
+            search_update(l, l->match >= 0  ? l->match
+                             : l->qlen > 1 ? history_len
+                                           : 1);
+            return 0;
+        }
+        search_end(l, true);
+        return c;
+    }
+}
 
+/* Start editing an empty line, showing the prompt. */
+static void line_edit_init(struct line_state *l,
+                           int stdin_fd,
+                           int stdout_fd,
+                           char *buf,
+                           size_t buflen,
+                           const char *prompt)
+{
     /* Populate the linenoise state that we pass to functions implementing
      * specific editing functionalities.
      */
-    l.ifd = stdin_fd;
-    l.ofd = stdout_fd;
-    l.buf = buf;
-    l.buflen = buflen;
-    l.prompt = prompt;
-    l.plen = strlen(prompt);
-    l.oldpos = l.pos = 0;
-    l.len = 0;
-    l.cols = get_columns(stdin_fd, stdout_fd);
-    l.maxrows = 0;
-    l.history_index = 0;
+    l->ifd = stdin_fd;
+    l->ofd = stdout_fd;
+    l->buf = buf;
+    l->buflen = buflen;
+    l->prompt = prompt;
+    l->plen = strlen(prompt);
+    l->pos = 0;
+    l->len = 0;
+    l->cols = get_columns(stdin_fd, stdout_fd);
+    l->history_index = 0;
+    l->searching = false;
+    l->completing = false;
+    l->escaping = false;
+    l->pasting = false;
 
     /* Buffer starts empty. */
-    l.buf[0] = '\0';
-    l.buflen--; /* Make sure there is always space for the nulterm */
+    l->buf[0] = '\0';
+    l->buflen--; /* Make sure there is always space for the nulterm */
 
     /* The latest history entry is always our current buffer, that
      * initially is just an empty string.
      */
     line_history_add("");
 
-    if (write(l.ofd, prompt, l.plen) == -1)
-        return -1;
-    while (1) {
-        signed char c;
-        int nread;
-        char seq[5];
+    refresh_reset();
+    refresh_line(l);
+}
 
-        nread = read(l.ifd, &c, 1);
-        if (nread <= 0)
-            return l.len;
+/* Give up a search or completion in progress, keeping the line shown. */
+static void line_edit_end(struct line_state *l)
+{
+    if (l->searching)
+        search_end(l, true);
+    if (l->completing)
+        complete_end(l);
+}
 
-        /* Only autocomplete when the callback is set. It returns < 0 when
-         * there was an error reading from fd. Otherwise it will return the
-         * character that should be handled next.
+/* The line is complete: return its length. */
+static int line_edit_enter(struct line_state *l)
+{
+    history_pop();
+    if (mlmode)
+        line_edit_move_end(l);
+    if (hints_callback) {
+        /* Force a refresh without hints to leave the previous
+         * line as the user typed it after a newline.
          */
-        if (c == 9 && completion_callback != NULL) {
-            c = complete_line(&l);
-            /* Return on errors */
-            if (c < 0)
-                return l.len;
-            /* Read next character when 0 */
-            if (c == 0)
-                continue;
-        }
+        line_hints_callback_t *hc = hints_callback;
+        hints_callback = NULL;
+        refresh_line(l);
+        hints_callback = hc;
+    }
+    return (int) l->len;
+}
 
-        switch (c) {
-        case ENTER: /* enter */
-            history_len--;
-            free(history[history_len]);
-            if (mlmode)
-                line_edit_move_end(&l);
-            if (hints_callback) {
-                /* Force a refresh without hints to leave the previous
-                 * line as the user typed it after a newline.
-                 */
-                line_hints_callback_t *hc = hints_callback;
-                hints_callback = NULL;
-                refresh_line(&l);
-                hints_callback = hc;
-            }
-            return (int) l.len;
-        case CTRL_C: /* ctrl-c */
-            errno = EAGAIN;
-            return -1;
-        case BACKSPACE: /* backspace */
-        case 8:         /* ctrl-h */
-            line_edit_backspace(&l);
-            break;
-        case CTRL_D: /* ctrl-d, remove char at right of cursor, or if the line
-                      * is empty, act as end-of-file.
-                      */
-            if (l.len > 0) {
-                line_edit_delete(&l);
-            } else {
-                history_len--;
-                free(history[history_len]);
-                return -1;
-            }
-            break;
-        case CTRL_T: /* ctrl-t, swaps current character with previous. */
-            if (l.pos > 0 && l.pos < l.len) {
-                int aux = buf[l.pos - 1];
-                buf[l.pos - 1] = buf[l.pos];
-                buf[l.pos] = aux;
-                if (l.pos != l.len - 1)
-                    l.pos++;
-                refresh_line(&l);
-            }
-            break;
-        case CTRL_B: /* ctrl-b */
-            line_edit_move_left(&l);
-            break;
-        case CTRL_F: /* ctrl-f */
-            line_edit_move_right(&l);
-            break;
-        case CTRL_P: /* ctrl-p */
-            line_edit_history_next(&l, LINENOISE_HISTORY_PREV);
-            break;
-        case CTRL_N: /* ctrl-n */
-            line_edit_history_next(&l, LINENOISE_HISTORY_NEXT);
-            break;
-        case ESC: /* escape sequence */
-            /* Read the next two bytes representing the escape sequence.
-             * Use two calls to handle slow terminals returning the two
-             * chars at different times.
-             */
-            if (read(l.ifd, seq, 1) == -1)
-                break;
-            if (read(l.ifd, seq + 1, 1) == -1)
-                break;
+/* Insert pasted text left over, up to its next line break.  Return as
+ * line_edit_key().
+ */
+static int line_edit_pasted(struct line_state *l)
+{
+    if (paste_len == 0 || l->pasting)
+        return LINE_EDIT_MORE;
+    return line_edit_paste(l) ? line_edit_enter(l) : LINE_EDIT_MORE;
+}
 
-            /* ESC [ sequences. */
-            if (seq[0] == '[') {
-                if (seq[1] >= '0' && seq[1] <= '9') {
-                    /* Extended escape, read additional byte. */
-                    if (read(l.ifd, seq + 2, 1) == -1)
-                        break;
-                    switch (seq[2]) {
-                    case '~':
-                        switch (seq[1]) {
-                        case '3': /* Delete key. */
-                            line_edit_delete(&l);
-                            break;
-                        }
-                        break;
+/* Add byte 'c' of a bracketed paste.  Once the paste ends with
+ * ESC [ 2 0 1 ~, its text is inserted.  Return as line_edit_key().
+ */
+static int paste_add(struct line_state *l, char c)
+{
+    static const char end[] = "\x1b[201~";
+    size_t endlen = sizeof(end) - 1;
+
+    if (paste_len == paste_size) {
+        size_t size = paste_size ? paste_size * 2 : 4096;
+        char *buf = realloc(paste_buf, size);
+        if (!buf)
+            return LINE_EDIT_MORE;
+        paste_buf = buf;
+        paste_size = size;
+    }
+    paste_buf[paste_len++] = c;
+    if (paste_len - paste_from < endlen ||
+        memcmp(paste_buf + paste_len - endlen, end, endlen))
+        return LINE_EDIT_MORE;
+    paste_len -= endlen;
+    l->pasting = false;
+    return line_edit_pasted(l);
+}
 
-                    case ';':
-                        /* Even more extended escape, read additional 2 bytes */
-                        if (read(l.ifd, seq + 3, 1) == -1)
-                            break;
-                        if (read(l.ifd, seq + 4, 1) == -1)
-                            break;
-                        if (seq[3] == '5') {
-                            switch (seq[4]) {
-                            case 'D': /* Ctrl Left */
-                                line_edit_prev_word(&l);
-                                break;
-                            case 'C': /* Ctrl Right */
-                                line_edit_next_word(&l);
-                                break;
-                            }
-                        }
-                        break;
-                    }
-                } else {
-                    switch (seq[1]) {
-                    case 'A': /* Up */
-                        line_edit_history_next(&l, LINENOISE_HISTORY_PREV);
-                        break;
-                    case 'B': /* Down */
-                        line_edit_history_next(&l, LINENOISE_HISTORY_NEXT);
-                        break;
-                    case 'C': /* Right */
-                        line_edit_move_right(&l);
-                        break;
-                    case 'D': /* Left */
-                        line_edit_move_left(&l);
-                        break;
-                    case 'H': /* Home */
-                        line_edit_move_home(&l);
+/* Whether l->seq holds a whole escape sequence: two bytes after ESC, three
+ * for ESC [ digit, and five for ESC [ digit ; and ESC [ digit 0.
+ */
+static bool escape_done(struct line_state *l)
+{
+    if (l->seqlen < 2)
+        return false;
+    if (l->seq[0] != '[' || l->seq[1] < '0' || l->seq[1] > '9')
+        return true;
+    if (l->seqlen < 3)
+        return false;
+    if (l->seq[2] != ';' && l->seq[2] != '0')
+        return true;
+    return l->seqlen == 5;
+}
+
+/* Handle the escape sequence in l->seq. */
+static void line_edit_escape(struct line_state *l)
+{
+    char *seq = l->seq;
+
+    /* ESC [ sequences. */
+    if (seq[0] == '[') {
+        if (seq[1] >= '0' && seq[1] <= '9') {
+            /* Extended escape. */
+            switch (seq[2]) {
+            case '~':
+                switch (seq[1]) {
+                case '3': /* Delete key. */
+                    line_edit_delete(l);
+                    break;
+                }
+                break;
+
+            case ';':
+                /* Even more extended escape */
+                if (seq[3] == '5') {
+                    switch (seq[4]) {
+                    case 'D': /* Ctrl Left */
+                        line_edit_prev_word(l);
                         break;
-                    case 'F': /* End*/
-                        line_edit_move_end(&l);
+                    case 'C': /* Ctrl Right */
+                        line_edit_next_word(l);
                         break;
                     }
                 }
-            }
+                break;
 
-            /* ESC O sequences. */
-            else if (seq[0] == 'O') {
-                switch (seq[1]) {
-                case 'H': /* Home */
-                    line_edit_move_home(&l);
-                    break;
-                case 'F': /* End*/
-                    line_edit_move_end(&l);
-                    break;
+            case '0':
+                /* Bracketed paste starts with ESC [ 2 0 0 ~ */
+                if (seq[1] == '2' && seq[3] == '0' && seq[4] == '~') {
+                    l->pasting = true;
+                    paste_from = paste_len;
                 }
+                break;
             }
+        } else {
+            switch (seq[1]) {
+            case 'A': /* Up */
+                line_edit_history_next(l, LINENOISE_HISTORY_PREV);
+                break;
+            case 'B': /* Down */
+                line_edit_history_next(l, LINENOISE_HISTORY_NEXT);
+                break;
+            case 'C': /* Right */
+                line_edit_move_right(l);
+                break;
+            case 'D': /* Left */
+                line_edit_move_left(l);
+                break;
+            case 'H': /* Home */
+                line_edit_move_home(l);
+                break;
+            case 'F': /* End*/
+                line_edit_move_end(l);
+                break;
+            }
+        }
+    }
+
+    /* ESC O sequences. */
+    else if (seq[0] == 'O') {
+        switch (seq[1]) {
+        case 'H': /* Home */
+            line_edit_move_home(l);
             break;
-        default:
-            if (line_edit_insert(&l, c))
-                return -1;
-            break;
-        case CTRL_U: /* Ctrl+u, delete the whole line. */
-            buf[0] = '\0';
-            l.pos = l.len = 0;
-            refresh_line(&l);
-            break;
-        case CTRL_K: /* Ctrl+k, delete from current to end of line. */
-            buf[l.pos] = '\0';
-            l.len = l.pos;
-            refresh_line(&l);
-            break;
-        case CTRL_A: /* Ctrl+a, go to the start of the line */
-            line_edit_move_home(&l);
-            break;
-        case CTRL_E: /* ctrl+e, go to the end of the line */
-            line_edit_move_end(&l);
-            break;
-        case CTRL_L: /* ctrl+l, clear screen */
-            line_clear_screen();
-            refresh_line(&l);
-            break;
-        case CTRL_W: /* ctrl+w, delete previous word */
-            line_edit_delete_prev_word(&l);
+        case 'F': /* End*/
+            line_edit_move_end(l);
             break;
         }
     }
-    return l.len;
+}
+
+/* This function is the core of the line editing capability of linenoise.
+ * It handles one byte 'c' read from the terminal, which is expected to be
+ * in "raw mode". Escape sequences and pastes are collected over as many
+ * calls as they take bytes, so the caller never waits for more input here.
+ *
+ * The resulting string is put into 'buf' when the user type enter, or
+ * when ctrl+d is typed.
+ *
+ * The function returns the length of the buffer once the line is complete,
+ * -1 on ctrl-c or ctrl-d on an empty line, and LINE_EDIT_MORE otherwise.
+ */
+static int line_edit_key(struct line_state *l, char c)
+{
+    if (l->pasting)
+        return paste_add(l, c);
+
+    if (l->escaping) {
+        /* Read the bytes of the escape sequence one call at a time, as
+         * slow terminals return them at different times.
+         */
+        l->seq[l->seqlen++] = c;
+        if (escape_done(l)) {
+            l->escaping = false;
+            line_edit_escape(l);
+        }
+        return LINE_EDIT_MORE;
+    }
+
+    if (l->searching && !(c = search_key(l, c)))
+        return LINE_EDIT_MORE;
+
+    /* Only autocomplete when the callback is set. It returns the character
+     * that should be handled next, or 0 when there is none.
+     */
+    if ((c == TAB || l->completing) && completion_callback != NULL) {
+        c = complete_line(l, c);
+        if (c == 0)
+            return LINE_EDIT_MORE;
+    }
+
+    switch (c) {
+    case ENTER: /* enter */
+        return line_edit_enter(l);
+    case CTRL_C: /* ctrl-c */
+        errno = EAGAIN;
+        return -1;
+    case BACKSPACE: /* backspace */
+    case 8:         /* ctrl-h */
+        line_edit_backspace(l);
+        break;
+    case CTRL_D: /* ctrl-d, remove char at right of cursor, or if the line
+                  * is empty, act as end-of-file.
+                  */
+        if (l->len > 0) {
+            line_edit_delete(l);
+        } else {
+            history_pop();
+            return -1;
+        }
+        break;
+    case CTRL_T: /* ctrl-t, swaps current character with previous. */
+        if (l->pos > 0 && l->pos < l->len) {
+            int aux = l->buf[l->pos - 1];
+            l->buf[l->pos - 1] = l->buf[l->pos];
+            l->buf[l->pos] = aux;
+            if (l->pos != l->len - 1)
+                l->pos++;
+            refresh_line(l);
+        }
+        break;
+    case CTRL_B: /* ctrl-b */
+        line_edit_move_left(l);
+        break;
+    case CTRL_F: /* ctrl-f */
+        line_edit_move_right(l);
+        break;
+    case CTRL_P: /* ctrl-p */
+        line_edit_history_next(l, LINENOISE_HISTORY_PREV);
+        break;
+    case CTRL_N: /* ctrl-n */
+        line_edit_history_next(l, LINENOISE_HISTORY_NEXT);
+        break;
+    case CTRL_R: /* ctrl-r, search the history backwards */
+        search_start(l);
+        break;
+    case ESC: /* escape sequence */
+        l->escaping = true;
+        l->seqlen = 0;
+        break;
+    default:
+        if (line_edit_insert(l, c))
+            return -1;
+        break;
+    case CTRL_U: /* Ctrl+u, delete the whole line. */
+        l->buf[0] = '\0';
+        l->pos = l->len = 0;
+        refresh_line(l);
+        break;
+    case CTRL_K: /* Ctrl+k, delete from current to end of line. */
+        l->buf[l->pos] = '\0';
+        l->len = l->pos;
+        refresh_line(l);
+        break;
+    case CTRL_A: /* Ctrl+a, go to the start of the line */
+        line_edit_move_home(l);
+        break;
+    case CTRL_E: /* ctrl+e, go to the end of the line */
+        line_edit_move_end(l);
+        break;
+    case CTRL_L: /* ctrl+l, clear screen */
+        line_clear_screen();
+        refresh_reset();
+        refresh_line(l);
+        break;
+    case CTRL_W: /* ctrl+w, delete previous word */
+        line_edit_delete_prev_word(l);
+        break;
+    }
+    return LINE_EDIT_MORE;
+}
+
+/* Edit a line, reading the terminal until it is complete.
+ *
+ * The function returns the length of the current buffer, or -1 as
+ * line_edit_key().
+ */
+static int line_edit(int stdin_fd,
+                     int stdout_fd,
+                     char *buf,
+                     size_t buflen,
+                     const char *prompt)
+{
+    struct line_state l;
+    int ret;
+
+    line_edit_init(&l, stdin_fd, stdout_fd, buf, buflen, prompt);
+    /* Pasted lines left over are inserted a line at a time */
+    while ((ret = line_edit_pasted(&l)) == LINE_EDIT_MORE) {
+        char c;
+        if (read(l.ifd, &c, 1) <= 0) {
+            line_edit_end(&l);
+            return l.len;
+        }
+        if ((ret = line_edit_key(&l, c)) != LINE_EDIT_MORE)
+            break;
+    }
+    return ret;
 }
 
 /* This function calls the line editing function line_edit() using
@@ -1224,6 +1683,123 @@ void line_free(void *ptr)
     free(ptr);
 }
 
+/* ========================= Non-blocking editing =========================== */
+
+/* The line edited for a program running its own event loop, which feeds the
+ * bytes read from the terminal one at a time.
+ */
+static struct line_state edit;
+static char edit_buf[LINENOISE_MAX_LINE];
+static const char *edit_prompt;
+static line_handler_t *edit_handler; /* NULL once editing stopped */
+static bool edit_running;            /* A line is being edited */
+static bool edit_hidden;             /* ... but erased for other output */
+
+/* Erase the line shown, leaving the cursor where its prompt started. */
+static void line_erase(struct line_state *l)
+{
+    struct abuf ab;
+
+    ab_init(&ab);
+    refresh_move(&ab, l, shown_pos, 0);
+    ab_append(&ab, "\x1b[0J", 4);
+    if (write(l->ofd, ab.b, ab.len) == -1) {
+    } /* Can't recover from write error. */
+    ab_free(&ab);
+    refresh_reset();
+}
+
+/* Start editing a new line, inserting pasted text left over.  Return as
+ * line_edit_key().
+ */
+static int edit_begin(void)
+{
+    if (enable_raw_mode(STDIN_FILENO) == -1)
+        return -1;
+    line_edit_init(&edit, STDIN_FILENO, STDOUT_FILENO, edit_buf,
+                   LINENOISE_MAX_LINE, edit_prompt);
+    edit_running = true;
+    edit_hidden = false;
+    return line_edit_pasted(&edit);
+}
+
+/* Act on result 'ret' of the last key.  A complete line is passed to the
+ * handler, and the next line started.  Pasted lines are handled in the same
+ * loop rather than by recursion, however many there are.
+ */
+static void edit_result(int ret)
+{
+    while (ret != LINE_EDIT_MORE && edit_handler) {
+        line_handler_t *handler = edit_handler;
+
+        edit_running = false;
+        disable_raw_mode(STDIN_FILENO);
+        printf("\n");
+        if (ret < 0) {
+            edit_handler = NULL;
+            handler(NULL);
+            return;
+        }
+        handler(strdup(edit_buf));
+        /* Unless the handler stopped editing, or started it over itself */
+        if (!edit_handler || edit_running)
+            return;
+        ret = edit_begin();
+    }
+}
+
+int line_edit_start(const char *prompt, line_handler_t *handler)
+{
+    if (!isatty(STDIN_FILENO) || is_unsupported_term()) {
+        errno = ENOTTY;
+        return -1;
+    }
+    line_edit_stop();
+    edit_prompt = prompt;
+    edit_handler = handler;
+    edit_result(edit_begin());
+    return 0;
+}
+
+void line_edit_feed(char c)
+{
+    if (!edit_running)
+        return;
+    line_edit_show();
+    edit_result(line_edit_key(&edit, c));
+}
+
+void line_edit_stop(void)
+{
+    if (edit_running) {
+        line_edit_end(&edit);
+        history_pop();
+        if (!edit_hidden)
+            line_erase(&edit);
+        disable_raw_mode(STDIN_FILENO);
+    }
+    edit_running = false;
+    edit_handler = NULL;
+}
+
+void line_edit_hide(void)
+{
+    if (!edit_running || edit_hidden)
+        return;
+    line_erase(&edit);
+    disable_raw_mode(STDIN_FILENO);
+    edit_hidden = true;
+}
+
+void line_edit_show(void)
+{
+    if (!edit_running || !edit_hidden)
+        return;
+    edit_hidden = false;
+    enable_raw_mode(STDIN_FILENO);
+    refresh_line(&edit);
+}
+
 /* ================================ History ================================= */
 
 /* Free the history, but does not reset it. Only used when we have to
@@ -1232,10 +1808,11 @@ void line_free(void *ptr)
 static void free_history(void)
 {
     if (history) {
-        for (int j = 0; j < history_len; j++)
-            free(history[j]);
+        while (history_len > 0)
+            history_pop();
         free(history);
     }
+    free_history_index();
 }
 
 /* At exit we'll try to fix the terminal to the initial conditions. */
@@ -1243,15 +1820,15 @@ static void line_atexit(void)
 {
     disable_raw_mode(STDIN_FILENO);
     free_history();
+    ab_free(&shown_text);
+    ab_free(&shown_hint);
+    free(paste_buf);
 }
 
 /* This is the API call to add a new entry in the linenoise history.
- * It uses a fixed array of char pointers that are shifted (memmoved)
- * when the history max length is reached in order to remove the older
- * entry and make room for the new one, so it is not exactly suitable for huge
- * histories, but will work well for a few hundred of entries.
- *
- * Using a circular buffer is smarter, but a bit more complex to handle.
+ * It uses a circular buffer of char pointers: when the history max length is
+ * reached, the oldest entry is freed and its slot reused for the new one, so
+ * adding takes constant time however long the history is.
  */
 int line_history_add(const char *line)
 {
@@ -1267,7 +1844,7 @@ int line_history_add(const char *line)
     }
 
     /* Don't add duplicated lines. */
-    if (history_len && !strcmp(history[history_len - 1], line))
+    if (history_len && !strcmp(*history_slot(0), line))
         return 0;
 
     /* Add an heap allocated copy of the line in the history.
@@ -1276,12 +1853,14 @@ int line_history_add(const char *line)
     if (!linecopy)
         return 0;
     if (history_len == history_max_len) {
-        free(history[0]);
-        memmove(history, history + 1, sizeof(char *) * (history_max_len - 1));
+        free(history[history_start]);
+        history_start = (history_start + 1) % history_max_len;
         history_len--;
     }
-    history[history_len] = linecopy;
     history_len++;
+    history_seq++;
+    *history_slot(0) = linecopy;
+    history_index_add(0);
     return 1;
 }
 
@@ -1304,14 +1883,17 @@ int line_history_set_max_len(int len)
 
         /* If we can't copy everything, free the elements we'll not use. */
         if (len < tocopy) {
-            for (int j = 0; j < tocopy - len; j++)
-                free(history[j]);
+            for (int j = tocopy - 1; j >= len; j--)
+                free(*history_slot(j));
             tocopy = len;
         }
+        /* Unroll the kept entries, oldest first */
         memset(new, 0, sizeof(char *) * len);
-        memcpy(new, history + (history_len - tocopy), sizeof(char *) * tocopy);
+        for (int j = 0; j < tocopy; j++)
+            new[j] = *history_slot(tocopy - 1 - j);
         free(history);
         history = new;
+        history_start = 0;
     }
     history_max_len = len;
     if (history_len > history_max_len)
@@ -1319,22 +1901,117 @@ int line_history_set_max_len(int len)
     return 1;
 }
 
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Forget the journal, closing it if it is open. */
+static void journal_close(void)
+{
+    if (journal_fd >= 0)
+        close(journal_fd);
+    journal_fd = -1;
+    free(journal_name);
+    journal_name = NULL;
+    journal_lines = 0;
+}
+
+/* Take 'filename', holding 'lines' lines, as the journal. */
+static void journal_set(const char *filename, int lines)
+{
+    journal_close();
+    journal_name = strdup(filename);
+    journal_lines = lines;
+}
+
 /* Save the history in the specified file. On success 0 is returned
  * otherwise -1 is returned.
+ *
+ * The whole history is written with one write to a temporary file, which
+ * then replaces the old one, so a crash never leaves a truncated history.
+ * This also compacts a journal grown by line_history_append().
  */
 int line_history_save(const char *filename)
 {
-    mode_t old_umask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
-
-    FILE *fp = fopen(filename, "w");
-    umask(old_umask);
-    if (!fp)
+    size_t size = 0;
+    for (int j = 0; j < history_len; j++)
+        size += strlen(*history_slot(j)) + 1;
+    char *buf = malloc(size + 1);
+    size_t tmplen = strlen(filename) + 5;
+    char *tmp = malloc(tmplen);
+    if (!buf || !tmp) {
+        free(buf);
+        free(tmp);
         return -1;
+    }
+    char *p = buf;
+    for (int j = history_len - 1; j >= 0; j--) {
+        size_t len = strlen(*history_slot(j));
+        memcpy(p, *history_slot(j), len);
+        p += len;
+        *p++ = '\n';
+    }
+    snprintf(tmp, tmplen, "%s.tmp", filename);
+
+    int ret = -1;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd >= 0) {
+        ret = write_all(fd, buf, size);
+        if (close(fd) < 0 || (ret == 0 && rename(tmp, filename) < 0))
+            ret = -1;
+        if (ret < 0)
+            unlink(tmp);
+    }
+    free(buf);
+    free(tmp);
 
-    chmod(filename, S_IRUSR | S_IWUSR);
-    for (int j = 0; j < history_len; j++)
-        fprintf(fp, "%s\n", history[j]);
-    fclose(fp);
+    if (ret == 0)
+        journal_set(filename, history_len);
+    return ret;
+}
+
+/* Append the newest history entry to the specified file, in one write,
+ * rather than rewriting the whole history. Once the file holds twice as many
+ * lines as the history keeps, it is compacted with line_history_save().
+ * On success 0 is returned otherwise -1 is returned.
+ */
+int line_history_append(const char *filename)
+{
+    if (history_len == 0)
+        return 0;
+
+    /* Lines of an unknown file are not counted, so start it afresh */
+    if (!journal_name || strcmp(journal_name, filename))
+        return line_history_save(filename);
+    if (journal_lines >= 2 * history_max_len)
+        return line_history_save(filename);
+
+    if (journal_fd < 0) {
+        journal_fd = open(filename, O_WRONLY | O_CREAT | O_APPEND,
+                          S_IRUSR | S_IWUSR);
+        if (journal_fd < 0)
+            return -1;
+    }
+    /* Appends of a single write are never interleaved with others */
+    char *line = *history_slot(0);
+    struct iovec iov[] = {
+        {.iov_base = line, .iov_len = strlen(line)},
+        {.iov_base = "\n", .iov_len = 1},
+    };
+    if (writev(journal_fd, iov, 2) != (ssize_t) (iov[0].iov_len + 1))
+        return -1;
+    journal_lines++;
     return 0;
 }
 
@@ -1346,19 +2023,64 @@ int line_history_save(const char *filename)
  */
 int line_hostory_load(const char *filename)
 {
-    FILE *fp = fopen(filename, "r");
-    if (!fp)
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
         return -1;
+    }
+    size_t size = st.st_size;
+    bool mapped = size >= LINENOISE_HISTORY_MMAP_SIZE;
+    char *data = NULL;
+    if (mapped) {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+            data = NULL;
+    } else if (size > 0 && (data = malloc(size))) {
+        ssize_t n = read(fd, data, size);
+        size = n > 0 ? n : 0;
+    }
+    close(fd);
+    if (!data && size > 0)
+        return -1;
+
+    /* Only the newest lines fit in the history, so skip the others */
+    int lines = 0;
+    for (char *p = data; p && (p = memchr(p, '\n', data + size - p)); p++)
+        lines++;
+    if (size > 0 && data[size - 1] != '\n')
+        lines++;
+    int skip = lines > history_max_len ? lines - history_max_len : 0;
 
     char buf[LINENOISE_MAX_LINE];
-    while (fgets(buf, LINENOISE_MAX_LINE, fp) != NULL) {
-        char *p = strchr(buf, '\r');
-        if (!p)
-            p = strchr(buf, '\n');
-        if (p)
-            *p = '\0';
-        line_history_add(buf);
-    }
-    fclose(fp);
+    char *end = data + size;
+    for (char *p = data; p < end;) {
+        char *eol = memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+        if (skip > 0) {
+            skip--;
+        } else {
+            size_t len = eol - p;
+            if (len >= LINENOISE_MAX_LINE)
+                len = LINENOISE_MAX_LINE - 1;
+            memcpy(buf, p, len);
+            buf[len] = '\0';
+            char *cr = strchr(buf, '\r');
+            if (cr)
+                *cr = '\0';
+            line_history_add(buf);
+        }
+        p = eol + 1;
+    }
+
+    if (mapped)
+        munmap(data, size);
+    else
+        free(data);
+    journal_set(filename, lines);
     return 0;
 }
@@ -65,11 +65,32 @@ void line_free(void *ptr);
 int line_history_add(const char *line);
 int line_history_set_max_len(int len);
 int line_history_save(const char *filename);
+int line_history_append(const char *filename);
 int line_hostory_load(const char *filename);
 void line_clear_screen(void);
 void line_set_multi_line(int ml);
 void line_mask_mode_enable(void);
 void line_mask_mode_disable(void);
+
+/* Non-blocking editing, for programs running their own event loop.
+ *
+ * line_edit_start() shows the prompt, and each byte read from standard
+ * input is then passed to line_edit_feed().  When a line is complete, the
+ * handler gets it, to be freed with line_free(), and editing goes on with
+ * the next line once the handler returns.  The handler gets NULL at end of
+ * input (ctrl-d on an empty line, or ctrl-c), after which editing stops.
+ * Around other output to the terminal, the line being edited is taken off
+ * the screen with line_edit_hide() and put back with line_edit_show().
+ *
+ * line_edit_start() returns -1 if standard input is not a terminal that
+ * can be edited on.
+ */
+typedef void(line_handler_t)(char *line);
+int line_edit_start(const char *prompt, line_handler_t *handler);
+void line_edit_feed(char c);
+void line_edit_stop(void);
+void line_edit_hide(void);
+void line_edit_show(void);
 #ifdef __cplusplus
 }
 #endif
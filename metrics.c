@@ -0,0 +1,261 @@
+/* Export of per-command metrics for trace runs */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "report.h"
+
+/* Our program needs to use regular malloc/free */
+#define INTERNAL 1
+#include "harness.h"
+
+#define METRICS_BUFSIZE 8192
+
+/* Maximum number of export functions */
+#define MAXEXPORT 4
+
+static int metrics_fd = -1;
+static bool csv_mode = false;
+static bool sync_records = false;
+static metrics_size_func_t size_func = NULL;
+static struct timespec start_time;
+
+/* Records are staged here and written out once the buffer fills up, or
+ * each one as it is complete in sync mode
+ */
+static char outbuf[METRICS_BUFSIZE];
+static size_t outlen = 0;
+
+static void metrics_flush()
+{
+    char *bufp = outbuf;
+    while (outlen > 0) {
+        ssize_t n = write(metrics_fd, bufp, outlen);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            report_event(MSG_WARN, "Could not write metrics record");
+            break;
+        }
+        bufp += n;
+        outlen -= n;
+    }
+    outlen = 0;
+}
+
+static void put_char(char c)
+{
+    if (outlen == METRICS_BUFSIZE)
+        metrics_flush();
+    outbuf[outlen++] = c;
+}
+
+static void put_str(const char *s)
+{
+    while (*s)
+        put_char(*s++);
+}
+
+static void put_fmt(char *fmt, ...)
+{
+    char buf[128];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    put_str(buf);
+}
+
+/* Emit string as JSON string literal */
+static void put_json_str(const char *s)
+{
+    put_char('"');
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            put_char('\\');
+            put_char(c);
+        } else if (c < 0x20) {
+            put_fmt("\\u%04x", c);
+        } else {
+            put_char(c);
+        }
+    }
+    put_char('"');
+}
+
+/* Emit string as quoted CSV field, doubling embedded quotes */
+static void put_csv_chars(const char *s)
+{
+    for (; *s; s++) {
+        if (*s == '"')
+            put_char('"');
+        put_char(*s);
+    }
+}
+
+bool metrics_open(char *file_name)
+{
+    static bool atexit_registered = false;
+
+    metrics_close();
+    metrics_fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (metrics_fd < 0)
+        return false;
+
+    size_t len = strlen(file_name);
+    csv_mode = len > 4 && strcmp(file_name + len - 4, ".csv") == 0;
+    if (csv_mode)
+        put_str("cmd,args,ok,time_us,blocks,bytes,peak_bytes,queue_size\n");
+
+    /* Make sure buffered records survive exit() on fatal errors */
+    if (!atexit_registered) {
+        atexit(metrics_close);
+        atexit_registered = true;
+    }
+    return true;
+}
+
+void metrics_set_size_func(metrics_size_func_t fn)
+{
+    size_func = fn;
+}
+
+void metrics_start()
+{
+    if (metrics_fd < 0)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+}
+
+static void put_record(int argc, char *argv[], bool ok)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double time_us = (now.tv_sec - start_time.tv_sec) * 1e6 +
+                     (now.tv_nsec - start_time.tv_nsec) * 1e-3;
+    int queue_size = size_func ? size_func() : 0;
+
+    if (csv_mode) {
+        put_char('"');
+        put_csv_chars(argv[0]);
+        put_str("\",\"");
+        for (int i = 1; i < argc; i++) {
+            if (i > 1)
+                put_char(' ');
+            put_csv_chars(argv[i]);
+        }
+        put_char('"');
+        put_fmt(",%d,%.3f,%zu,%zu,%zu,%d\n", ok ? 1 : 0, time_us,
+                allocation_check(), allocation_bytes(), mem_peak_bytes(),
+                queue_size);
+        return;
+    }
+
+    put_str("{\"cmd\":");
+    put_json_str(argv[0]);
+    put_str(",\"args\":[");
+    for (int i = 1; i < argc; i++) {
+        if (i > 1)
+            put_char(',');
+        put_json_str(argv[i]);
+    }
+    put_fmt("],\"ok\":%s,\"time_us\":%.3f", ok ? "true" : "false", time_us);
+    put_fmt(",\"blocks\":%zu,\"bytes\":%zu", allocation_check(),
+            allocation_bytes());
+    put_fmt(",\"peak_bytes\":%zu,\"queue_size\":%d}\n", mem_peak_bytes(),
+            queue_size);
+}
+
+void metrics_record(int argc, char *argv[], bool ok)
+{
+    if (metrics_fd < 0 || argc == 0)
+        return;
+
+    put_record(argc, argv, ok);
+    if (sync_records)
+        metrics_flush();
+}
+
+void metrics_set_sync(bool on)
+{
+    sync_records = on;
+    if (on && metrics_fd >= 0)
+        metrics_flush();
+}
+
+void metrics_close()
+{
+    if (metrics_fd < 0)
+        return;
+
+    metrics_flush();
+    close(metrics_fd);
+    metrics_fd = -1;
+}
+
+static metrics_export_func_t export_funcs[MAXEXPORT];
+static int export_cnt = 0;
+static metrics_emit_func_t export_emit = NULL;
+
+void metrics_add_export_func(metrics_export_func_t fn)
+{
+    if (export_cnt < MAXEXPORT)
+        export_funcs[export_cnt++] = fn;
+    else
+        report_event(MSG_FATAL, "Exceeded limit on metrics export functions");
+}
+
+void metrics_family(char *name, char *type, char *help)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s %s\n", name, help,
+             name, type);
+    export_emit(buf);
+}
+
+void metrics_sample(char *name, char *labels, double value)
+{
+    char buf[256];
+    if (labels)
+        snprintf(buf, sizeof(buf), "%s{%s} %.17g\n", name, labels, value);
+    else
+        snprintf(buf, sizeof(buf), "%s %.17g\n", name, value);
+    export_emit(buf);
+}
+
+void metrics_export(metrics_emit_func_t emit)
+{
+    export_emit = emit;
+
+    metrics_family("qtest_peak_bytes", "gauge",
+                   "Peak bytes held through malloc_or_fail and friends");
+    metrics_sample("qtest_peak_bytes", NULL, mem_peak_bytes());
+    metrics_family("qtest_current_bytes", "gauge",
+                   "Bytes held through malloc_or_fail and friends");
+    metrics_sample("qtest_current_bytes", NULL, mem_current_bytes());
+    metrics_family("qtest_allocated_blocks", "gauge",
+                   "Blocks allocated with test_malloc and not yet freed");
+    metrics_sample("qtest_allocated_blocks", NULL, allocation_check());
+    metrics_family("qtest_allocated_bytes", "gauge",
+                   "Payload bytes of blocks allocated with test_malloc");
+    metrics_sample("qtest_allocated_bytes", NULL, allocation_bytes());
+    metrics_family("qtest_malloc_fail_probability", "gauge",
+                   "Percent probability of test_malloc failing on purpose");
+    metrics_sample("qtest_malloc_fail_probability", NULL, fail_probability);
+    metrics_family("qtest_injected_failures_total", "counter",
+                   "Calls of test_malloc failed on purpose");
+    metrics_sample("qtest_injected_failures_total", NULL,
+                   allocation_failures());
+
+    for (int i = 0; i < export_cnt; i++)
+        export_funcs[i]();
+    export_emit = NULL;
+}
@@ -0,0 +1,64 @@
+#ifndef LAB0_METRICS_H
+#define LAB0_METRICS_H
+
+#include <stdbool.h>
+
+/* Machine-readable per-command metrics.
+ *
+ * Each executed command produces one record holding its name and
+ * arguments, wall time, harness allocation statistics, the peak memory
+ * tracked by report.c and the size of the current queue.  Files ending in
+ * ".csv" get CSV rows; any other name gets one JSON object per line.
+ */
+
+/* Function returning the size of the current queue */
+typedef int (*metrics_size_func_t)(void);
+
+/* Start writing records to file.  Return true if successful */
+bool metrics_open(char *file_name);
+
+/* Supply function used to look up the queue size */
+void metrics_set_size_func(metrics_size_func_t fn);
+
+/* Mark the start of a command */
+void metrics_start();
+
+/* Emit record for the command started by the last call to metrics_start */
+void metrics_record(int argc, char *argv[], bool ok);
+
+/* Write each record out as soon as it is complete if on, for readers of
+ * the file while it is written, such as the web server
+ */
+void metrics_set_sync(bool on);
+
+/* Flush pending records and close the file */
+void metrics_close();
+
+/* Live metrics in Prometheus text format, as served by the web server.
+ *
+ * The export holds the allocator statistics of report.c and the harness,
+ * followed by whatever the registered export functions add with
+ * metrics_family and metrics_sample.
+ */
+
+/* Function adding samples to an export */
+typedef void (*metrics_export_func_t)(void);
+
+/* Function receiving the text of an export, piece by piece */
+typedef void (*metrics_emit_func_t)(char *text);
+
+/* Run fn as part of every export */
+void metrics_add_export_func(metrics_export_func_t fn);
+
+/* Produce export through emit */
+void metrics_export(metrics_emit_func_t emit);
+
+/* Describe metric family name, whose samples follow.  type is "counter"
+ * or "gauge".
+ */
+void metrics_family(char *name, char *type, char *help);
+
+/* Add sample of name with labels, given as 'key="value",...' or NULL */
+void metrics_sample(char *name, char *labels, double value);
+
+#endif /* LAB0_METRICS_H */
@@ -45,7 +45,10 @@ extern int show_entropy;
 #include "queue.h"
 
 #include "console.h"
+#include "metrics.h"
 #include "report.h"
+#include "ring.h"
+#include "web.h"
 
 /* Settable parameters */
 
@@ -67,6 +70,11 @@ typedef struct {
 static queue_chain_t chain = {.size = 0};
 static queue_contex_t *current = NULL;
 
+/* ID of next queue.  IDs are never reused, so that one held by an IPC
+ * client cannot come to name another queue after its own is freed.
+ */
+static int next_queue_id = 0;
+
 /* How many times can queue operations fail */
 static int fail_limit = BIG_LIST_SIZE;
 static int fail_count = 0;
@@ -79,6 +87,7 @@ static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
 
 /* Forward declarations */
 static bool q_show(int vlevel);
+static void queue_drop_rings(queue_contex_t *ctx);
 
 static bool do_free(int argc, char *argv[])
 {
@@ -106,6 +115,7 @@ static bool do_free(int argc, char *argv[])
     }
 
     if (current) {
+        queue_drop_rings(current);
         list_del(&current->chain);
 
         if (exception_setup(true))
@@ -133,6 +143,21 @@ static bool do_free(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Append new queue to chain.  Return its context, or NULL on failure */
+static queue_contex_t *queue_add()
+{
+    queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
+    if (!qctx)
+        return NULL;
+    list_add_tail(&qctx->chain, &chain.head);
+
+    qctx->size = 0;
+    qctx->q = q_new();
+    qctx->id = next_queue_id++;
+    chain.size++;
+    return qctx;
+}
+
 static bool do_new(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -143,14 +168,9 @@ static bool do_new(int argc, char *argv[])
     bool ok = true;
 
     if (exception_setup(true)) {
-        queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
-        list_add_tail(&qctx->chain, &chain.head);
-
-        qctx->size = 0;
-        qctx->q = q_new();
-        qctx->id = chain.size++;
-
-        current = qctx;
+        queue_contex_t *qctx = queue_add();
+        if (qctx)
+            current = qctx;
     }
     exception_cancel();
     q_show(3);
@@ -982,6 +1002,235 @@ static bool do_next(int argc, char *argv[])
     return q_show(0);
 }
 
+/* Queue with given ID, or NULL if there is none */
+static queue_contex_t *find_queue(uint32_t id)
+{
+    queue_contex_t *ctx;
+    list_for_each_entry (ctx, &chain.head, chain) {
+        if ((uint32_t) ctx->id == id)
+            return ctx;
+    }
+    return NULL;
+}
+
+/* Shared-memory ring feeding the tail of a queue */
+typedef struct {
+    ring_t *ring;
+    queue_contex_t *ctx;
+    struct list_head list;
+} queue_ring_t;
+
+static LIST_HEAD(rings);
+
+/* Most strings inserted from a ring before other input is served */
+#define RING_BATCH 4096
+
+static void ring_drop(queue_ring_t *qr)
+{
+    ipc_unwatch(ring_pollfd(qr->ring));
+    ring_free(qr->ring);
+    list_del(&qr->list);
+    free(qr);
+}
+
+/* Drop rings feeding ctx, before it is deleted */
+static void queue_drop_rings(queue_contex_t *ctx)
+{
+    queue_ring_t *qr, *tmp;
+    list_for_each_entry_safe (qr, tmp, &rings, list) {
+        if (qr->ctx == ctx)
+            ring_drop(qr);
+    }
+}
+
+/* Insert strings published to ring at tail of its queue */
+static void ring_ready(int fd, void *arg)
+{
+    queue_ring_t *qr = arg;
+    ring_woken(qr->ring);
+    if (exception_setup(true)) {
+        char *s;
+        for (int n = 0; n < RING_BATCH && (s = ring_next(qr->ring)); n++) {
+            if (q_insert_tail(qr->ctx->q, s))
+                qr->ctx->size++;
+            else
+                fail_count++;
+        }
+    }
+    exception_cancel();
+    /* Skips a string whose insertion crashed, and picks up any left */
+    ring_sleep(qr->ring);
+    error_check();
+}
+
+/* Create ring of size bytes feeding ctx, and reply with its descriptors */
+static void ring_add(ipc_request_t *req, queue_contex_t *ctx, size_t size)
+{
+    queue_ring_t *qr = malloc(sizeof(queue_ring_t));
+    if (!qr || !(qr->ring = ring_new(size))) {
+        free(qr);
+        ipc_reply(req, IPC_FAILED, 0, NULL, 0);
+        return;
+    }
+    qr->ctx = ctx;
+    if (!ipc_watch(ring_pollfd(qr->ring), ring_ready, qr)) {
+        ring_free(qr->ring);
+        free(qr);
+        ipc_reply(req, IPC_FAILED, 0, NULL, 0);
+        return;
+    }
+    list_add_tail(&qr->list, &rings);
+    int fds[] = {ring_memfd(qr->ring), ring_wakefd(qr->ring)};
+    ipc_reply_fds(req, IPC_OK, size, fds, 2);
+}
+
+/* Delete queue ctx, moving on to next queue if it is the current one */
+static void queue_del(queue_contex_t *ctx)
+{
+    if (ctx == current) {
+        struct list_head *next =
+            ctx->chain.next == &chain.head ? chain.head.next : ctx->chain.next;
+        current = next != &ctx->chain ? list_entry(next, queue_contex_t, chain)
+                                      : NULL;
+    }
+    queue_drop_rings(ctx);
+    list_del(&ctx->chain);
+    chain.size--;
+
+    struct list_head *q = ctx->q;
+    bool big = ctx->size > BIG_LIST_SIZE;
+    free(ctx);
+    if (big)
+        set_cautious_mode(false);
+    q_free(q);
+    set_cautious_mode(true);
+}
+
+/* Run request of command channel on its queue, and reply to it.  The
+ * operation runs under its own exception setup and time limit, so that a
+ * request that crashes or runs out of time fails alone.  Only its result is
+ * taken from within, and the queue size updated from it afterwards.
+ */
+static void ipc_run(ipc_request_t *req)
+{
+    static char removes[MAXSTRING + 1];
+    queue_contex_t *ctx = NULL;
+    queue_contex_t *volatile added = NULL;
+    element_t *volatile re = NULL;
+    volatile bool inserted = false;
+    volatile int size = 0;
+
+    if (req->op != IPC_SYNC && req->op != IPC_NEW &&
+        !(ctx = find_queue(req->queue))) {
+        ipc_reply(req, IPC_ERROR, 0, NULL, 0);
+        return;
+    }
+    /* String must come with its terminating null character */
+    if ((req->op == IPC_IH || req->op == IPC_IT) &&
+        (!req->len || req->data[req->len - 1] != '\0')) {
+        ipc_reply(req, IPC_ERROR, 0, NULL, 0);
+        return;
+    }
+
+    if (!exception_setup(true)) {
+        exception_cancel();
+        set_cautious_mode(true);
+        ipc_reply(req, IPC_ERROR, 0, NULL, 0);
+        return;
+    }
+    switch (req->op) {
+    case IPC_NEW:
+        added = queue_add();
+        break;
+    case IPC_FREE:
+        queue_del(ctx);
+        break;
+    case IPC_IH:
+        inserted = q_insert_head(ctx->q, req->data);
+        break;
+    case IPC_IT:
+        inserted = q_insert_tail(ctx->q, req->data);
+        break;
+    case IPC_RH:
+    case IPC_RT:
+        removes[0] = '\0';
+        re = req->op == IPC_RH
+                 ? q_remove_head(ctx->q, removes, sizeof(removes))
+                 : q_remove_tail(ctx->q, removes, sizeof(removes));
+        break;
+    case IPC_SIZE:
+        size = q_size(ctx->q);
+        break;
+    case IPC_REVERSE:
+        q_reverse(ctx->q);
+        break;
+    case IPC_SORT:
+        q_sort(ctx->q);
+        break;
+    }
+    exception_cancel();
+
+    switch (req->op) {
+    case IPC_SYNC:
+    case IPC_FREE:
+        ipc_reply(req, IPC_OK, 0, NULL, 0);
+        break;
+    case IPC_NEW:
+        if (added && !current)
+            current = added;
+        ipc_reply(req, added && added->q ? IPC_OK : IPC_FAILED,
+                  added ? added->id : 0, NULL, 0);
+        break;
+    case IPC_IH:
+    case IPC_IT:
+        if (inserted) {
+            ctx->size++;
+            ipc_reply(req, IPC_OK, ctx->size, NULL, 0);
+        } else {
+            fail_count++;
+            ipc_reply(req, IPC_FAILED, ctx->size, NULL, 0);
+        }
+        break;
+    case IPC_RH:
+    case IPC_RT:
+        if (!re) {
+            ipc_reply(req, IPC_FAILED, ctx->size, NULL, 0);
+            break;
+        }
+        q_release_element(re);
+        ctx->size--;
+        removes[MAXSTRING] = '\0';
+        ipc_reply(req, IPC_OK, ctx->size, removes, strlen(removes) + 1);
+        break;
+    case IPC_SIZE:
+        ipc_reply(req, IPC_OK, size, NULL, 0);
+        break;
+    case IPC_REVERSE:
+    case IPC_SORT:
+        ipc_reply(req, IPC_OK, ctx->size, NULL, 0);
+        break;
+    case IPC_RING: {
+        /* Optional payload: ring size in bytes */
+        uint32_t bytes = RING_DEFSIZE;
+        if (req->len == sizeof(bytes))
+            memcpy(&bytes, req->data, sizeof(bytes));
+        ring_add(req, ctx, bytes ? bytes : RING_DEFSIZE);
+        break;
+    }
+    default:
+        ipc_reply(req, IPC_ERROR, 0, NULL, 0);
+        break;
+    }
+}
+
+/* Run batch of requests from command channel */
+static void q_ipc(ipc_request_t *reqs, int n)
+{
+    for (int i = 0; i < n; i++)
+        ipc_run(&reqs[i]);
+    error_check();
+}
+
 static void console_init()
 {
     ADD_COMMAND(new, "Create new queue", "");
@@ -1024,6 +1273,7 @@ static void console_init()
               NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
+    add_ipc_command(q_ipc);
 }
 
 /* Signal handlers */
@@ -1053,6 +1303,30 @@ static void q_init()
     signal(SIGALRM, sigalrm_handler);
 }
 
+/* Size of the current queue, as recorded in metrics */
+static int q_metrics_size()
+{
+    return current ? current->size : 0;
+}
+
+/* Add queues and failed operations to metrics export */
+static void q_metrics_export()
+{
+    char labels[32];
+
+    metrics_family("qtest_queues", "gauge", "Queues in the chain");
+    metrics_sample("qtest_queues", NULL, chain.size);
+    metrics_family("qtest_queue_size", "gauge", "Elements in each queue");
+    queue_contex_t *ctx;
+    list_for_each_entry (ctx, &chain.head, chain) {
+        snprintf(labels, sizeof(labels), "id=\"%d\"", ctx->id);
+        metrics_sample("qtest_queue_size", labels, ctx->size);
+    }
+    metrics_family("qtest_failed_operations_total", "counter",
+                   "Queue operations that failed while malloc was failing");
+    metrics_sample("qtest_failed_operations_total", NULL, fail_count);
+}
+
 static bool q_quit(int argc, char *argv[])
 {
     return true;
@@ -1087,11 +1361,17 @@ static bool q_quit(int argc, char *argv[])
 
 static void usage(char *cmd)
 {
-    printf("Usage: %s [-h] [-f IFILE][-v VLEVEL][-l LFILE]\n", cmd);
+    printf(
+        "Usage: %s [-h] [-f IFILE][-F CFILE][-c CFILE][-v VLEVEL][-l LFILE]"
+        "[-m MFILE]\n",
+        cmd);
     printf("\t-h         Print this information\n");
     printf("\t-f IFILE   Read commands from IFILE\n");
+    printf("\t-F CFILE   Read commands from compiled file CFILE\n");
+    printf("\t-c CFILE   Compile IFILE into CFILE instead of running it\n");
     printf("\t-v VLEVEL  Set verbosity level\n");
     printf("\t-l LFILE   Echo results to LFILE\n");
+    printf("\t-m MFILE   Write per-command metrics to MFILE (JSON or .csv)\n");
     exit(0);
 }
 
@@ -1159,10 +1439,15 @@ int main(int argc, char *argv[])
     char *infile_name = NULL;
     char lbuf[BUFSIZE];
     char *logfile_name = NULL;
+    char mbuf[BUFSIZE];
+    char *metrics_name = NULL;
+    char cbuf[BUFSIZE];
+    char *compiled_name = NULL;
+    bool compile = false;
     int level = 4;
     int c;
 
-    while ((c = getopt(argc, argv, "hv:f:l:")) != -1) {
+    while ((c = getopt(argc, argv, "hv:f:F:c:l:m:")) != -1) {
         switch (c) {
         case 'h':
             usage(argv[0]);
@@ -1172,6 +1457,13 @@ int main(int argc, char *argv[])
             buf[BUFSIZE - 1] = '\0';
             infile_name = buf;
             break;
+        case 'F':
+        case 'c':
+            strncpy(cbuf, optarg, BUFSIZE);
+            cbuf[BUFSIZE - 1] = '\0';
+            compiled_name = cbuf;
+            compile = c == 'c';
+            break;
         case 'v': {
             char *endptr;
             errno = 0;
@@ -1187,6 +1479,11 @@ int main(int argc, char *argv[])
             buf[BUFSIZE - 1] = '\0';
             logfile_name = lbuf;
             break;
+        case 'm':
+            strncpy(mbuf, optarg, BUFSIZE);
+            mbuf[BUFSIZE - 1] = '\0';
+            metrics_name = mbuf;
+            break;
         default:
             printf("Unknown option '%c'\n", c);
             usage(argv[0]);
@@ -1202,9 +1499,15 @@ int main(int argc, char *argv[])
     q_init();
     init_cmd();
     console_init();
+    metrics_add_export_func(q_metrics_export);
+
+    if (compile && !infile_name) {
+        fprintf(stderr, "Option -c needs a command file given with -f\n");
+        exit(EXIT_FAILURE);
+    }
 
-    /* Initialize linenoise only when infile_name not exist */
-    if (!infile_name) {
+    /* Initialize linenoise only when reading commands from terminal */
+    if (!infile_name && !compiled_name) {
         /* Trigger call back function(auto completion) */
         line_set_completion_callback(completion);
 
@@ -1215,13 +1518,27 @@ int main(int argc, char *argv[])
     set_verblevel(level);
     if (level > 1)
         set_echo(true);
-    if (logfile_name)
-        set_logfile(logfile_name);
+    /* Files written are also served by the web server */
+    if (logfile_name && set_logfile(logfile_name))
+        web_add_file(logfile_name);
+    if (metrics_name) {
+        if (!metrics_open(metrics_name)) {
+            fprintf(stderr, "Couldn't open metrics file '%s'\n", metrics_name);
+            exit(EXIT_FAILURE);
+        }
+        metrics_set_size_func(q_metrics_size);
+        web_add_file(metrics_name);
+    }
 
     add_quit_helper(q_quit);
 
     bool ok = true;
-    ok = ok && run_console(infile_name);
+    if (compile)
+        ok = ok && compile_cmd(infile_name, compiled_name);
+    else if (compiled_name)
+        ok = ok && run_compiled(compiled_name);
+    else
+        ok = ok && run_console(infile_name);
 
     /* Do finish_cmd() before check whether ok is true or false */
     ok = finish_cmd() && ok;
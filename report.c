@@ -96,7 +96,6 @@ void report_event(message_t msg, char *fmt, ...)
 }
 
 #define BUF_SIZE 4096
-extern int web_connfd;
 void report(int level, char *fmt, ...)
 {
     if (!verbfile)
@@ -298,6 +297,16 @@ void free_string(char *s)
     free_block((void *) s, strlen(s) + 1);
 }
 
+size_t mem_peak_bytes()
+{
+    return peak_bytes;
+}
+
+size_t mem_current_bytes()
+{
+    return current_bytes;
+}
+
 /* Initialization of timers */
 void init_time(double *timep)
 {
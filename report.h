@@ -44,6 +44,10 @@ void free_array(void *b, size_t cnt, size_t bytes);
 /* Free string saved by strsave_or_fail */
 void free_string(char *s);
 
+/* Peak and current number of bytes held through the allocators above */
+size_t mem_peak_bytes();
+size_t mem_current_bytes();
+
 /* Time counted as fp number in seconds */
 void init_time(double *timep);
 
@@ -0,0 +1,291 @@
+/* Implementation of a shared-memory string ring between two processes */
+
+/* memfd_create is only declared with _GNU_SOURCE */
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+#include "ipc.h"
+#include "ring.h"
+
+#define CACHELINE 64
+
+/* Layout of shared memory.  Each side writes its own cache line only */
+typedef struct {
+    _Alignas(CACHELINE) uint64_t head; /* Taken up to here, by consumer */
+    _Alignas(CACHELINE) uint64_t tail; /* Published up to here, by producer */
+    _Alignas(CACHELINE) uint32_t waiting; /* Consumer sleeps, to be woken */
+    uint32_t size;
+    _Alignas(CACHELINE) char data[];
+} ring_shared_t;
+
+struct __ring {
+    ring_shared_t *shm;
+    size_t size, mask;
+    int memfd;
+    int rfd, wfd; /* Wakeup channel, the same eventfd where available */
+    uint64_t pos; /* Local end of records taken or added */
+    uint64_t end; /* Consumer: last tail seen.  Producer: last head seen */
+};
+
+static size_t align(size_t n)
+{
+    return (n + RING_ALIGN - 1) & ~(size_t) (RING_ALIGN - 1);
+}
+
+/* Map shared memory of r, of size bytes */
+static bool ring_map(ring_t *r, size_t size)
+{
+    void *p = mmap(NULL, sizeof(ring_shared_t) + size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, r->memfd, 0);
+    if (p == MAP_FAILED)
+        return false;
+    r->shm = p;
+    r->size = size;
+    r->mask = size - 1;
+    return true;
+}
+
+static bool valid_size(size_t size)
+{
+    return size >= RING_MINSIZE && size <= RING_MAXSIZE &&
+           !(size & (size - 1));
+}
+
+/* Open anonymous shared memory and wakeup channel of r */
+static bool ring_open(ring_t *r)
+{
+#if defined(__linux__)
+    r->memfd = memfd_create("qtest-ring", MFD_CLOEXEC);
+    r->rfd = r->wfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    return r->memfd >= 0 && r->rfd >= 0;
+#else
+    char name[64];
+    snprintf(name, sizeof(name), "/qtest-ring-%d", (int) getpid());
+    r->memfd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (r->memfd >= 0)
+        shm_unlink(name);
+    int fds[2];
+    if (pipe(fds) < 0)
+        return false;
+    r->rfd = fds[0];
+    r->wfd = fds[1];
+    fcntl(r->rfd, F_SETFL, O_NONBLOCK);
+    return r->memfd >= 0;
+#endif
+}
+
+ring_t *ring_new(size_t size)
+{
+    if (!valid_size(size)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    ring_t *r = calloc(1, sizeof(ring_t));
+    if (!r)
+        return NULL;
+    r->memfd = r->rfd = r->wfd = -1;
+    if (!ring_open(r) ||
+        ftruncate(r->memfd, sizeof(ring_shared_t) + size) < 0 ||
+        !ring_map(r, size)) {
+        ring_free(r);
+        return NULL;
+    }
+    r->shm->size = size;
+    /* Nothing published yet, so the first string needs a wakeup */
+    r->shm->waiting = 1;
+    return r;
+}
+
+int ring_memfd(ring_t *r)
+{
+    return r->memfd;
+}
+
+int ring_wakefd(ring_t *r)
+{
+    return r->wfd;
+}
+
+int ring_pollfd(ring_t *r)
+{
+    return r->rfd;
+}
+
+static void wake(ring_t *r)
+{
+    uint64_t one = 1;
+    /* A full counter or pipe already holds a wakeup */
+    if (write(r->wfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        perror("ring wakeup");
+}
+
+void ring_woken(ring_t *r)
+{
+    uint64_t cnt;
+    while (read(r->rfd, &cnt, sizeof(cnt)) > 0)
+        ;
+    __atomic_store_n(&r->shm->waiting, 0, __ATOMIC_RELAXED);
+}
+
+char *ring_next(ring_t *r)
+{
+    while (true) {
+        if (r->pos == r->end) {
+            r->end = __atomic_load_n(&r->shm->tail, __ATOMIC_ACQUIRE);
+            if (r->pos == r->end)
+                return NULL;
+        }
+
+        size_t off = r->pos & r->mask;
+        uint32_t len;
+        memcpy(&len, r->shm->data + off, sizeof(len));
+        if (len == RING_SKIP) {
+            r->pos += r->size - off;
+            continue;
+        }
+        char *str = r->shm->data + off + sizeof(len);
+        if (len == 0 || len > r->size - off - sizeof(len) ||
+            str[len - 1] != '\0') {
+            /* Corrupt record: drop everything published */
+            r->pos = r->end;
+            return NULL;
+        }
+        r->pos += align(sizeof(len) + len);
+        return str;
+    }
+}
+
+void ring_sleep(ring_t *r)
+{
+    ring_shared_t *s = r->shm;
+    __atomic_store_n(&s->head, r->pos, __ATOMIC_RELEASE);
+    __atomic_store_n(&s->waiting, 1, __ATOMIC_RELAXED);
+    /* Pairs with fence in ring_publish: either producer sees the flag, or
+     * this sees the strings it published
+     */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->tail, __ATOMIC_RELAXED) != r->pos)
+        wake(r);
+}
+
+ring_t *ring_connect(int sock, uint32_t queue, size_t size)
+{
+    ring_t *r = calloc(1, sizeof(ring_t));
+    if (!r)
+        return NULL;
+    r->memfd = r->rfd = r->wfd = -1;
+
+    struct {
+        ipc_header_t h;
+        uint32_t size;
+    } req = {{.len = sizeof(uint32_t), .op = IPC_RING, .arg = queue}, size};
+    if (send(sock, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req))
+        goto fail;
+
+    ipc_header_t h;
+    struct iovec iov = {.iov_base = &h, .iov_len = sizeof(h)};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } ctl;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = ctl.buf,
+        .msg_controllen = sizeof(ctl.buf),
+    };
+    if (recvmsg(sock, &msg, MSG_WAITALL) != sizeof(h) || h.flags != IPC_OK)
+        goto fail;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+        goto fail;
+    int fds[2];
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    r->memfd = fds[0];
+    r->rfd = r->wfd = fds[1];
+
+    if (!valid_size(h.arg) || !ring_map(r, h.arg))
+        goto fail;
+    r->pos = __atomic_load_n(&r->shm->tail, __ATOMIC_RELAXED);
+    r->end = __atomic_load_n(&r->shm->head, __ATOMIC_ACQUIRE);
+    return r;
+
+fail:
+    ring_free(r);
+    return NULL;
+}
+
+bool ring_push(ring_t *r, const char *str, size_t len)
+{
+    size_t need = align(sizeof(uint32_t) + len + 1);
+    size_t off = r->pos & r->mask;
+    size_t skip = need > r->size - off ? r->size - off : 0;
+
+    if (r->pos + skip + need - r->end > r->size) {
+        r->end = __atomic_load_n(&r->shm->head, __ATOMIC_ACQUIRE);
+        if (r->pos + skip + need - r->end > r->size) {
+            ring_publish(r);
+            return false;
+        }
+    }
+
+    if (skip) {
+        uint32_t mark = RING_SKIP;
+        memcpy(r->shm->data + off, &mark, sizeof(mark));
+        r->pos += skip;
+        off = 0;
+    }
+    uint32_t size = len + 1;
+    char *rec = r->shm->data + off;
+    memcpy(rec, &size, sizeof(size));
+    memcpy(rec + sizeof(size), str, len);
+    rec[sizeof(size) + len] = '\0';
+    r->pos += need;
+    return true;
+}
+
+void ring_publish(ring_t *r)
+{
+    ring_shared_t *s = r->shm;
+    __atomic_store_n(&s->tail, r->pos, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->waiting, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&s->waiting, 0, __ATOMIC_RELAXED))
+        wake(r);
+}
+
+bool ring_drained(ring_t *r)
+{
+    return __atomic_load_n(&r->shm->head, __ATOMIC_ACQUIRE) ==
+           __atomic_load_n(&r->shm->tail, __ATOMIC_RELAXED);
+}
+
+void ring_free(ring_t *r)
+{
+    if (!r)
+        return;
+    if (r->shm)
+        munmap(r->shm, sizeof(ring_shared_t) + r->size);
+    if (r->memfd >= 0)
+        close(r->memfd);
+    if (r->rfd >= 0)
+        close(r->rfd);
+    if (r->wfd >= 0 && r->wfd != r->rfd)
+        close(r->wfd);
+    free(r);
+}
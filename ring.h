@@ -0,0 +1,85 @@
+#ifndef LAB0_RING_H
+#define LAB0_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Single-producer, single-consumer ring of strings, in memory shared with
+ * another process.  qtest creates a ring for a queue when asked through the
+ * command channel (see ipc.h), and passes its memory and wakeup descriptors
+ * back over the socket.  The producer copies strings straight into the ring,
+ * and qtest inserts them into the queue from there, with no copy or parsing
+ * in between.
+ *
+ * A record is a 32-bit length, counting the terminating null character, and
+ * the string, padded to RING_ALIGN bytes.  Records never wrap around; the
+ * length RING_SKIP sends the consumer back to the start of the ring instead.
+ * The consumer only sleeps after announcing it in shared memory, so the
+ * producer writes to the wakeup descriptor once per sleep, not per string.
+ *
+ * The producer is trusted not to change a record after publishing it.
+ */
+
+#define RING_ALIGN 8
+#define RING_SKIP UINT32_MAX
+
+/* Bounds of ring size in bytes, which must be a power of 2 */
+#define RING_MINSIZE 4096
+#define RING_MAXSIZE (1 << 30)
+#define RING_DEFSIZE (1 << 20)
+
+typedef struct __ring ring_t;
+
+/* Consumer */
+
+/* Create ring of size bytes.  Return NULL on failure */
+ring_t *ring_new(size_t size);
+
+/* Descriptor of shared memory, to be passed to producer */
+int ring_memfd(ring_t *r);
+
+/* Descriptor producer writes to wake consumer, to be passed to producer */
+int ring_wakefd(ring_t *r);
+
+/* Descriptor readable when consumer is woken */
+int ring_pollfd(ring_t *r);
+
+/* Acknowledge wakeup, before taking strings */
+void ring_woken(ring_t *r);
+
+/* Next published string, or NULL if there is none.  The string stays valid
+ * until ring_sleep is called.
+ */
+char *ring_next(ring_t *r);
+
+/* Hand space of strings taken back to producer, and wait for wakeup.  If
+ * more strings are already published, wake up again at once.
+ */
+void ring_sleep(ring_t *r);
+
+/* Producer */
+
+/* Ask qtest, over connected command channel sock, for ring of size bytes
+ * feeding the tail of queue with given ID.  Return NULL on failure.
+ */
+ring_t *ring_connect(int sock, uint32_t queue, size_t size);
+
+/* Add string of len bytes, not counting the terminating null character.
+ * Return false if ring is full, after publishing the strings added.
+ * Strings are only seen by consumer once published.
+ */
+bool ring_push(ring_t *r, const char *str, size_t len);
+
+/* Publish strings added so far, waking consumer if it sleeps */
+void ring_publish(ring_t *r);
+
+/* Whether consumer has taken every published string */
+bool ring_drained(ring_t *r);
+
+/* Both */
+
+/* Unmap ring and close its descriptors */
+void ring_free(ring_t *r);
+
+#endif /* LAB0_RING_H */
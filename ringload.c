@@ -0,0 +1,218 @@
+/* Throughput benchmark of the shared-memory ring of qtest.
+ *
+ * Connects to the command channel of qtest (the ipc command), creates a
+ * queue, and fills its tail with strings through a ring, until qtest has
+ * taken all of them.  For comparison, the same strings are then sent as
+ * quiet insert requests over the socket itself.  Both are run more than
+ * once, as the first round also pays for growing the heap of qtest.
+ */
+
+#include <getopt.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipc.h"
+#include "ring.h"
+
+/* Frames of requests sent at once over the socket */
+#define SENDBUF 65536
+
+static char *path = "qtest.sock";
+static unsigned long total = 1000000;
+static size_t length = 16;
+static unsigned batch = 256;
+static size_t ring_size = RING_DEFSIZE;
+static int rounds = 2;
+static int sock;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fail(char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+static void send_all(void *buf, size_t len)
+{
+    if (send(sock, buf, len, MSG_NOSIGNAL) != (ssize_t) len)
+        fail("Cannot send to qtest");
+}
+
+/* Send request, and return value of its reply.  Replies to quiet requests
+ * sent before, which only come on failure, are counted in *failed.
+ */
+static uint32_t call(int op, uint32_t queue, unsigned long *failed)
+{
+    ipc_header_t h = {.op = op, .arg = queue};
+    send_all(&h, sizeof(h));
+    while (true) {
+        char data[IPC_MAXPAYLOAD];
+        if (recv(sock, &h, sizeof(h), MSG_WAITALL) != sizeof(h) ||
+            (h.len && recv(sock, data, h.len, MSG_WAITALL) != h.len))
+            fail("Connection to qtest lost");
+        if (h.op == op)
+            break;
+        if (failed)
+            (*failed)++;
+    }
+    if (h.flags != IPC_OK)
+        fail("Request to qtest failed");
+    return h.arg;
+}
+
+/* Print result, then delete queue */
+static void summary(char *name,
+                    double elapsed,
+                    uint32_t queue,
+                    unsigned long failed)
+{
+    uint32_t size = call(IPC_SIZE, queue, NULL);
+    printf("%-6s %lu strings in %.3f s, %.0f strings/s, %u in queue%s\n", name,
+           total, elapsed, total / elapsed, size,
+           size == total - failed ? "" : " (some lost)");
+    call(IPC_FREE, queue, NULL);
+}
+
+static void run_ring(char *str)
+{
+    uint32_t queue = call(IPC_NEW, 0, NULL);
+    ring_t *r = ring_connect(sock, queue, ring_size);
+    if (!r)
+        fail("Cannot create ring");
+
+    double start = now();
+    for (unsigned long i = 0; i < total; i++) {
+        while (!ring_push(r, str, length))
+            sched_yield();
+        if ((i + 1) % batch == 0)
+            ring_publish(r);
+    }
+    ring_publish(r);
+    while (!ring_drained(r))
+        sched_yield();
+    double elapsed = now() - start;
+
+    ring_free(r);
+    summary("ring", elapsed, queue, 0);
+}
+
+static void run_socket(char *str)
+{
+    uint32_t queue = call(IPC_NEW, 0, NULL);
+    size_t frame = sizeof(ipc_header_t) + length + 1;
+    char *buf = malloc(SENDBUF + frame);
+    if (!buf)
+        fail("Out of memory");
+    ipc_header_t h = {
+        .len = length + 1, .op = IPC_IT, .flags = IPC_QUIET, .arg = queue};
+
+    double start = now();
+    size_t len = 0;
+    for (unsigned long i = 0; i < total; i++) {
+        memcpy(buf + len, &h, sizeof(h));
+        memcpy(buf + len + sizeof(h), str, length + 1);
+        len += frame;
+        if (len >= SENDBUF) {
+            send_all(buf, len);
+            len = 0;
+        }
+    }
+    send_all(buf, len);
+    unsigned long failed = 0;
+    call(IPC_SYNC, 0, &failed);
+    double elapsed = now() - start;
+
+    free(buf);
+    summary("socket", elapsed, queue, failed);
+}
+
+static void usage(char *cmd)
+{
+    printf("Usage: %s [-h] [-s PATH] [-n STRINGS] [-l LENGTH] [-b BATCH] "
+           "[-S SIZE] [-r ROUNDS]\n",
+           cmd);
+    printf("\t-h          Print this information\n");
+    printf("\t-s PATH     Socket of qtest command channel (default: %s)\n",
+           path);
+    printf("\t-n STRINGS  Number of strings to insert\n");
+    printf("\t-l LENGTH   Length of each string\n");
+    printf("\t-b BATCH    Strings added to ring before publishing them\n");
+    printf("\t-S SIZE     Bytes of ring, a power of 2\n");
+    printf("\t-r ROUNDS   Times each way of inserting is measured\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "hs:n:l:b:S:r:")) != -1) {
+        switch (c) {
+        case 'h':
+            usage(argv[0]);
+            break;
+        case 's':
+            path = optarg;
+            break;
+        case 'n':
+            total = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            length = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            batch = strtoul(optarg, NULL, 10);
+            break;
+        case 'S':
+            ring_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        default:
+            printf("Unknown option '%c'\n", c);
+            usage(argv[0]);
+            break;
+        }
+    }
+    /* Strings must fit in a request, and several in the ring */
+    if (total == 0 || batch == 0 || rounds <= 0 || length >= IPC_MAXPAYLOAD ||
+        ring_size < RING_MINSIZE || length >= ring_size / 4)
+        fail("Invalid number of strings, length, batch, size or rounds");
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 ||
+        connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Cannot connect to %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    char *str = malloc(length + 1);
+    if (!str)
+        fail("Out of memory");
+    for (size_t i = 0; i < length; i++)
+        str[i] = 'a' + i % 26;
+    str[length] = '\0';
+
+    for (int i = 0; i < rounds; i++) {
+        run_ring(str);
+        run_socket(str);
+    }
+    free(str);
+    close(sock);
+    return 0;
+}
@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+
+from __future__ import print_function
+import getopt
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+
+# Load test comparing the I/O backends of the qtest web server, with load
+# generated by webload
+class Bench:
+
+    qtest = "./qtest"
+    webload = "./webload"
+    port = 9999
+
+    def __init__(self, port, loadArgs):
+        self.port = port
+        self.loadArgs = loadArgs
+
+    def start(self, uring):
+        # Echoed output is not read until the end, so never fill a pipe
+        self.output = tempfile.TemporaryFile(mode="w+")
+        proc = subprocess.Popen([self.qtest], stdin=subprocess.PIPE,
+                                stdout=self.output,
+                                universal_newlines=True)
+        proc.stdin.write("option web_uring %d\nweb %d\n" %
+                         (uring, self.port))
+        proc.stdin.flush()
+        # Output to a pipe is buffered, so wait for the port instead
+        for i in range(100):
+            try:
+                socket.create_connection(("127.0.0.1", self.port)).close()
+                return proc
+            except socket.error:
+                time.sleep(0.05)
+        proc.kill()
+        return None
+
+    def run(self, uring):
+        proc = self.start(uring)
+        if not proc:
+            print("ERROR: Could not start web server")
+            sys.exit(1)
+        try:
+            load = subprocess.run([self.webload, "-p", str(self.port)] +
+                                  self.loadArgs, stdout=subprocess.PIPE,
+                                  universal_newlines=True)
+        finally:
+            proc.kill()
+            proc.wait()
+            self.output.seek(0)
+            output = self.output.read()
+            self.output.close()
+        name = "io_uring" if "(io_uring)" in output else "event loop"
+        if uring and name != "io_uring":
+            name += " (io_uring not available)"
+        print(name)
+        print(load.stdout, end="")
+
+
+def usageFinish():
+    print("Usage: %s [-h] [-p PORT] [-c CONNS] [-n REQUESTS] [-r RATE] [-C]" %
+          sys.argv[0])
+    print("  -h          Print this message")
+    print("  -p PORT     Port of web server")
+    print("  -c CONNS    Number of concurrent connections")
+    print("  -n REQUESTS Number of requests to send")
+    print("  -r RATE     Total requests per second, unlimited if not given")
+    print("  -C          Open a new connection for every request")
+    sys.exit(0)
+
+
+def run(name, args):
+    port = 9999
+    loadArgs = []
+
+    optlist, args = getopt.getopt(args, 'hp:c:n:r:C')
+    for (opt, val) in optlist:
+        if opt == '-h':
+            usageFinish()
+        elif opt == '-p':
+            port = int(val)
+        else:
+            # Passed on to webload
+            loadArgs += [opt, val] if val else [opt]
+    bench = Bench(port, loadArgs + args)
+    for uring in (0, 1):
+        bench.run(uring)
+
+
+if __name__ == "__main__":
+    run(sys.argv[0], sys.argv[1:])
@@ -0,0 +1,245 @@
+#!/usr/bin/env python3
+
+from __future__ import print_function
+import getopt
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+
+# Checks of the qtest web server that the traces cannot make, as they need
+# a client: how POSTed scripts are answered, depending on whether the
+# connection is kept open and the client accepts chunks, how ranges of
+# files are answered, and that a client not reading its responses does not
+# hold up others.  Run against both I/O backends.
+class Tester:
+
+    qtest = "./qtest"
+    port = 9999
+    timeout = 10
+    script = "new\nih a\nit b\nsize\nfree\n"
+    expected = "Queue size = 2"
+
+    def __init__(self, port):
+        self.port = port
+        self.failed = 0
+
+    def start(self, uring):
+        self.output = tempfile.TemporaryFile(mode="w+")
+        proc = subprocess.Popen([self.qtest], stdin=subprocess.PIPE,
+                                stdout=self.output, stderr=self.output,
+                                universal_newlines=True)
+        proc.stdin.write("option web_uring %d\nweb %d\n" %
+                         (uring, self.port))
+        proc.stdin.flush()
+        for i in range(100):
+            try:
+                socket.create_connection(("127.0.0.1", self.port)).close()
+                return proc
+            except socket.error:
+                time.sleep(0.05)
+        proc.kill()
+        return None
+
+    def connect(self):
+        sock = socket.create_connection(("127.0.0.1", self.port))
+        sock.settimeout(self.timeout)
+        return sock
+
+    def post(self, version, headers):
+        return ("POST / %s\r\n%sContent-Length: %d\r\n\r\n%s" %
+                (version, headers, len(self.script), self.script)).encode()
+
+    # Read from sock until data ends with terminator, or until the server
+    # closes the connection if terminator is None.  Return what was read,
+    # and whether the connection was closed.
+    def receive(self, sock, terminator):
+        data = b""
+        while terminator is None or not data.endswith(terminator):
+            try:
+                chunk = sock.recv(65536)
+            except socket.timeout:
+                return data, False
+            if not chunk:
+                return data, True
+            data += chunk
+        return data, False
+
+    def decode_chunks(self, body):
+        text = b""
+        while True:
+            line, _, body = body.partition(b"\r\n")
+            size = int(line, 16)
+            if size == 0:
+                return text
+            text += body[:size]
+            body = body[size + 2:]
+
+    def check(self, name, ok):
+        print("---\t%s\t%s" % (name, "ok" if ok else "FAILED"))
+        if not ok:
+            self.failed += 1
+
+    def check_response(self, name, data, chunked):
+        header, _, body = data.partition(b"\r\n\r\n")
+        is_chunked = b"Transfer-Encoding: chunked" in header
+        if is_chunked:
+            try:
+                body = self.decode_chunks(body)
+            except ValueError:
+                body = b""
+        self.check(name, header.startswith(b"HTTP/1.1 200") and
+                   is_chunked == chunked and
+                   self.expected in body.decode(errors="replace"))
+
+    def run_keep_alive(self):
+        sock = self.connect()
+        sock.sendall(self.post("HTTP/1.1", ""))
+        data, closed = self.receive(sock, b"0\r\n\r\n")
+        self.check_response("POST kept alive", data, True)
+        sock.sendall(b"GET /size HTTP/1.1\r\nConnection: close\r\n\r\n")
+        data, closed = self.receive(sock, None)
+        self.check("GET after POST", b"HTTP/1.1 200" in data)
+        sock.close()
+
+    def run_close(self):
+        sock = self.connect()
+        sock.sendall(self.post("HTTP/1.1", "Connection: close\r\n"))
+        data, closed = self.receive(sock, None)
+        self.check_response("POST with Connection: close", data, True)
+        self.check("Connection closed after POST", closed)
+        sock.close()
+
+    def run_http10(self):
+        sock = self.connect()
+        sock.sendall(self.post("HTTP/1.0", ""))
+        data, closed = self.receive(sock, None)
+        self.check_response("POST from HTTP/1.0 client", data, False)
+        self.check("Connection closed after HTTP/1.0 POST", closed)
+        sock.close()
+
+    # HTTP/1.0 client asking to keep the connection is told it is kept
+    def run_http10_keep_alive(self):
+        sock = self.connect()
+        sock.sendall(b"GET /size HTTP/1.0\r\nConnection: keep-alive\r\n\r\n")
+        data, closed = self.receive(sock, b"\n")
+        self.check("HTTP/1.0 GET kept alive",
+                   b"Connection: keep-alive\r\n" in data and not closed)
+        sock.sendall(b"GET /size HTTP/1.0\r\n\r\n")
+        data, closed = self.receive(sock, None)
+        self.check("Connection closed after next HTTP/1.0 GET",
+                   b"HTTP/1.1 200" in data and closed)
+        sock.close()
+
+    # Loop left open by a script is dropped with its script, and does not
+    # take in commands of other requests
+    def run_open_loop(self):
+        sock = self.connect()
+        body = "new\nrepeat 2 {\nit a\n"
+        sock.sendall(("POST / HTTP/1.1\r\nConnection: close\r\n"
+                      "Content-Length: %d\r\n\r\n%s" %
+                      (len(body), body)).encode())
+        data, closed = self.receive(sock, None)
+        self.check("Loop left open by script reported",
+                   b"Loop not ended" in data)
+        sock.close()
+        sock = self.connect()
+        sock.sendall(b"GET /it/b HTTP/1.1\r\nConnection: close\r\n\r\n")
+        data, closed = self.receive(sock, None)
+        self.check("Command run after script left loop open",
+                   b"l = [b]" in data)
+        sock.close()
+
+    # Ranges of a file served, and how those that cannot be served or do
+    # not parse are answered
+    def run_ranges(self):
+        for value, status in (("-3", b"206"), ("-0", b"416"),
+                              ("abc", b"200")):
+            sock = self.connect()
+            sock.sendall(("GET /traces/trace-01-ops.cmd HTTP/1.1\r\n"
+                          "Range: bytes=%s\r\nConnection: close\r\n\r\n" %
+                          value).encode())
+            data, closed = self.receive(sock, None)
+            self.check("Range bytes=%s" % value,
+                       data.startswith(b"HTTP/1.1 " + status))
+            sock.close()
+
+    # Clients that do not read large responses must leave the server free to
+    # answer others.  There is one more of them than there are I/O threads.
+    def run_slow_clients(self):
+        # Queue shows as 30 KB, which the socket buffers cannot take 300
+        # times, once the clients take little in theirs
+        body = ("new\n" + ("ih %s\n" % ("x" * 1000)) * 30 + "show\n" * 300 +
+                "free\n")
+        slow = []
+        for i in range(3):
+            sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+            sock.connect(("127.0.0.1", self.port))
+            sock.settimeout(self.timeout)
+            sock.sendall(("POST / HTTP/1.1\r\nContent-Length: %d\r\n\r\n%s" %
+                          (len(body), body)).encode())
+            slow.append(sock)
+            time.sleep(0.5)
+        sock = self.connect()
+        sock.sendall(b"GET /size HTTP/1.1\r\nConnection: close\r\n\r\n")
+        data, closed = self.receive(sock, None)
+        self.check("GET while other clients do not read",
+                   b"HTTP/1.1 200" in data and closed)
+        sock.close()
+        # Unread responses are still there as a whole
+        for sock in slow:
+            data, closed = self.receive(sock, b"0\r\n\r\n")
+            self.check("Response to client reading late",
+                       data.endswith(b"0\r\n\r\n") and
+                       data.count(b"Current queue ID") == 300)
+            sock.close()
+
+    def run(self, uring):
+        proc = self.start(uring)
+        if not proc:
+            print("ERROR: Could not start web server")
+            sys.exit(1)
+        print("io_uring" if uring else "event loop")
+        try:
+            self.run_keep_alive()
+            self.run_close()
+            self.run_http10()
+            self.run_http10_keep_alive()
+            self.run_open_loop()
+            self.run_ranges()
+            self.run_slow_clients()
+        finally:
+            proc.kill()
+            proc.wait()
+            self.output.close()
+
+
+def usageFinish():
+    print("Usage: %s [-h] [-p PORT]" % sys.argv[0])
+    print("  -h          Print this message")
+    print("  -p PORT     Port of web server")
+    sys.exit(0)
+
+
+def run(name, args):
+    port = 9999
+
+    optlist, args = getopt.getopt(args, 'hp:')
+    for (opt, val) in optlist:
+        if opt == '-h':
+            usageFinish()
+        elif opt == '-p':
+            port = int(val)
+    tester = Tester(port)
+    for uring in (0, 1):
+        tester.run(uring)
+    if tester.failed:
+        print("ERROR: %d checks failed" % tester.failed)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    run(sys.argv[0], sys.argv[1:])
@@ -0,0 +1,302 @@
+/* Implementation of a minimal io_uring interface, without liburing */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#if HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+struct __uring {
+    int fd;
+    unsigned entries;
+    /* Submission ring, shared with the kernel */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_tail; /* Entries up to here are filled, maybe not submitted */
+    /* Completion ring, shared with the kernel */
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    /* Mappings */
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+
+static int sys_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete)
+{
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                   NULL, 0);
+}
+
+uring_t *uring_new(unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    uring_t *r = calloc(1, sizeof(uring_t));
+    if (!r)
+        return NULL;
+    r->fd = sys_setup(entries, &p);
+    if (r->fd < 0) {
+        /* Kernel too old, or io_uring disabled */
+        free(r);
+        return NULL;
+    }
+    r->entries = p.sq_entries;
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size =
+        p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && r->cq_ring_size > r->sq_ring_size)
+        r->sq_ring_size = r->cq_ring_size;
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq_ring = single ? r->sq_ring
+                        : mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, r->fd,
+                               IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED ||
+        r->sqes == MAP_FAILED) {
+        uring_free(r);
+        return NULL;
+    }
+
+    char *sq = r->sq_ring;
+    r->sq_head = (unsigned *) (sq + p.sq_off.head);
+    r->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *) (sq + p.sq_off.array);
+    r->sqe_tail = *r->sq_tail;
+
+    char *cq = r->cq_ring;
+    r->cq_head = (unsigned *) (cq + p.cq_off.head);
+    r->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return r;
+}
+
+void uring_free(uring_t *r)
+{
+    if (!r)
+        return;
+    if (r->sqes && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring && r->sq_ring != MAP_FAILED)
+        munmap(r->sq_ring, r->sq_ring_size);
+    close(r->fd);
+    free(r);
+}
+
+bool uring_register_buffer(uring_t *r, void *buf, size_t len)
+{
+    struct iovec iov = {.iov_base = buf, .iov_len = len};
+    return syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS,
+                   &iov, 1) == 0;
+}
+
+/* Hand filled entries to the kernel, and wait for wait completions */
+static int submit(uring_t *r, unsigned wait)
+{
+    unsigned n = r->sqe_tail - *r->sq_tail;
+    if (n == 0 && wait == 0)
+        return 0;
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+
+    int ret;
+    do {
+        /* Asking for more than is left to submit is harmless on retry */
+        ret = sys_enter(r->fd, n, wait);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+/* Return cleared submission entry, or NULL if the ring stays full */
+static struct io_uring_sqe *get_sqe(uring_t *r)
+{
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sqe_tail - head == r->entries) {
+        if (submit(r, 0) < 0)
+            return NULL;
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (r->sqe_tail - head == r->entries)
+            return NULL;
+    }
+
+    unsigned idx = r->sqe_tail++ & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    return sqe;
+}
+
+static struct io_uring_sqe *prep(uring_t *r,
+                                 int op,
+                                 int fd,
+                                 void *addr,
+                                 size_t len,
+                                 uint64_t data)
+{
+    struct io_uring_sqe *sqe = get_sqe(r);
+    if (sqe) {
+        sqe->opcode = op;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t) addr;
+        sqe->len = len;
+        sqe->user_data = data;
+    }
+    return sqe;
+}
+
+bool uring_accept(uring_t *r, int fd, bool multishot, uint64_t data)
+{
+#ifndef IORING_ACCEPT_MULTISHOT
+    if (multishot)
+        return false; /* Headers too old */
+#endif
+    struct io_uring_sqe *sqe = prep(r, IORING_OP_ACCEPT, fd, NULL, 0, data);
+    if (!sqe)
+        return false;
+#ifdef IORING_ACCEPT_MULTISHOT
+    if (multishot)
+        sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+#endif
+    return true;
+}
+
+bool uring_recv(uring_t *r, int fd, void *buf, size_t len, uint64_t data)
+{
+    return prep(r, IORING_OP_RECV, fd, buf, len, data);
+}
+
+bool uring_read_fixed(uring_t *r, int fd, void *buf, size_t len, uint64_t data)
+{
+    struct io_uring_sqe *sqe =
+        prep(r, IORING_OP_READ_FIXED, fd, buf, len, data);
+    if (!sqe)
+        return false;
+    sqe->buf_index = 0;
+    return true;
+}
+
+bool uring_poll(uring_t *r, int fd, bool multishot, uint64_t data)
+{
+    struct io_uring_sqe *sqe = prep(r, IORING_OP_POLL_ADD, fd, NULL, 0, data);
+    if (!sqe)
+        return false;
+    sqe->poll32_events = POLLIN;
+    if (multishot)
+        sqe->len = IORING_POLL_ADD_MULTI;
+    return true;
+}
+
+bool uring_poll_write(uring_t *r, int fd, uint64_t data)
+{
+    struct io_uring_sqe *sqe = prep(r, IORING_OP_POLL_ADD, fd, NULL, 0, data);
+    if (!sqe)
+        return false;
+    sqe->poll32_events = POLLOUT;
+    return true;
+}
+
+bool uring_close(uring_t *r, int fd, uint64_t data)
+{
+    return prep(r, IORING_OP_CLOSE, fd, NULL, 0, data);
+}
+
+int uring_run(uring_t *r, uring_handler_t handler, void *arg)
+{
+    unsigned head = *r->cq_head;
+    bool ready = head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    if (submit(r, ready ? 0 : 1) < 0 && errno != EBUSY)
+        return -1;
+
+    int cnt = 0;
+    while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        uint64_t data = cqe->user_data;
+        int res = cqe->res;
+        bool more = cqe->flags & IORING_CQE_F_MORE;
+        /* Release entry before handler queues further requests */
+        __atomic_store_n(r->cq_head, ++head, __ATOMIC_RELEASE);
+        handler(data, res, more, arg);
+        cnt++;
+    }
+    return cnt;
+}
+
+#else /* !HAVE_IO_URING */
+
+uring_t *uring_new(unsigned entries)
+{
+    return NULL;
+}
+
+void uring_free(uring_t *r) {}
+
+bool uring_register_buffer(uring_t *r, void *buf, size_t len)
+{
+    return false;
+}
+
+bool uring_accept(uring_t *r, int fd, bool multishot, uint64_t data)
+{
+    return false;
+}
+
+bool uring_recv(uring_t *r, int fd, void *buf, size_t len, uint64_t data)
+{
+    return false;
+}
+
+bool uring_read_fixed(uring_t *r, int fd, void *buf, size_t len, uint64_t data)
+{
+    return false;
+}
+
+bool uring_poll(uring_t *r, int fd, bool multishot, uint64_t data)
+{
+    return false;
+}
+
+bool uring_poll_write(uring_t *r, int fd, uint64_t data)
+{
+    return false;
+}
+
+bool uring_close(uring_t *r, int fd, uint64_t data)
+{
+    return false;
+}
+
+int uring_run(uring_t *r, uring_handler_t handler, void *arg)
+{
+    return -1;
+}
+
+#endif /* HAVE_IO_URING */
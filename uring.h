@@ -0,0 +1,49 @@
+#ifndef LAB0_URING_H
+#define LAB0_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Minimal io_uring interface, talking to the kernel directly.  Requests are
+ * queued in the submission ring and handed to the kernel together by
+ * uring_run, which also collects their completions.  Where io_uring is not
+ * available, uring_new fails, and callers are expected to fall back to
+ * plain system calls.  A ring must only be used by one thread.
+ */
+
+typedef struct __uring uring_t;
+
+/* Function run for each completion.  data is as given when the request was
+ * queued, res is the result of the corresponding system call, or a negated
+ * errno value on failure.  more is set if further completions of a
+ * multishot request follow.
+ */
+typedef void (*uring_handler_t)(uint64_t data, int res, bool more, void *arg);
+
+/* Create ring with room for entries requests.  Return NULL on failure */
+uring_t *uring_new(unsigned entries);
+
+void uring_free(uring_t *r);
+
+/* Register buf as fixed buffer, for uring_read_fixed */
+bool uring_register_buffer(uring_t *r, void *buf, size_t len);
+
+/* Queue requests.  Return false if the request cannot be queued */
+bool uring_accept(uring_t *r, int fd, bool multishot, uint64_t data);
+bool uring_recv(uring_t *r, int fd, void *buf, size_t len, uint64_t data);
+/* buf must lie within the registered buffer */
+bool uring_read_fixed(uring_t *r, int fd, void *buf, size_t len, uint64_t data);
+/* Wait for fd to become readable */
+bool uring_poll(uring_t *r, int fd, bool multishot, uint64_t data);
+/* Wait once for fd to have room to write */
+bool uring_poll_write(uring_t *r, int fd, uint64_t data);
+bool uring_close(uring_t *r, int fd, uint64_t data);
+
+/* Submit queued requests, wait for at least one completion, then run
+ * handler for every completion available.  Return number of completions
+ * handled, or -1 on error.
+ */
+int uring_run(uring_t *r, uring_handler_t handler, void *arg);
+
+#endif /* LAB0_URING_H */
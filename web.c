@@ -4,75 +4,192 @@
 
 #include <arpa/inet.h> /* inet_ntoa */
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/socket.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "list.h"
+#include "uring.h"
+#include "web.h"
+
 #define LISTENQ 1024 /* second argument to listen() */
-#define MAXLINE 1024 /* max length of a line */
-#define BUFSIZE 1024
+#define BUFSIZE 8192 /* max length of a request header */
 
 #ifndef DEFAULT_PORT
 #define DEFAULT_PORT 9999 /* use this port if none given as arg to main() */
 #endif
 
-#if defined(__APPLE__) || defined(__FreeBSD__)
-#define TCP_CORK TCP_NOPUSH
-#endif
+/* Number of I/O threads */
+#define WEB_WORKERS 2
+
+/* Maximum number of files and directories served */
+#define WEB_MAXFILES 8
+
+/* Most requests of a connection queued at once.  Reading from the
+ * connection pauses beyond that.
+ */
+#define WEB_MAXPENDING 16
+
+/* Output of a command still running is sent as a chunk of the response
+ * once this many bytes are collected, or when output follows this many
+ * milliseconds after the last chunk, so clients see it as it is produced.
+ */
+#define WEB_FLUSH_SIZE 32768
+#define WEB_FLUSH_INTERVAL 100
+
+/* Requests queued in the io_uring of each I/O thread at once */
+#define WEB_URING_ENTRIES 1024
+
+/* Receive buffers registered with each io_uring.  Connections beyond that
+ * receive into buffers of their own.
+ */
+#define WEB_URING_SLOTS 256
+
+/* Tags of io_uring requests not tied to a connection.  Receives are tagged
+ * with their connection, which is never such a small address.
+ */
+#define URING_ACCEPT 1
+#define URING_WAKE 2
+#define URING_CLOSE 3
+
+/* Set in the tag of a poll for room to send on a connection, which is the
+ * address of the connection otherwise
+ */
+#define URING_WRITABLE 1
+
+/* Connections are served by a few I/O threads, which accept them, read and
+ * parse requests, and send responses.  Commands of requests are queued as
+ * jobs to a single executor, the thread that called web_open, so they run
+ * one at a time in order of arrival, interleaved with console input.  Their
+ * report output is collected in the job, which is then handed back to the
+ * I/O thread of its connection.  Sends never block: what a slow client does
+ * not take yet stays queued on its connection, so other connections of the
+ * thread go on being served.
+ */
+typedef struct __web_worker web_worker_t;
+
+/* Persistent connection, owned by the I/O thread that accepted it.
+ * Requests may be pipelined, so buf can hold several of them.
+ */
+typedef struct {
+    int fd; /* -1 once closed */
+    web_worker_t *worker;
+    struct list_head node; /* In connections of worker, until released */
+    size_t len;         /* Bytes received but not yet handled */
+    char *buf;          /* BUFSIZE bytes, and room for terminating null */
+    int slot;           /* Registered buffer holding buf, or -1 */
+    bool armed;         /* Receive queued in io_uring */
+    bool in_script;     /* Receiving body of POSTed script */
+    size_t script_left; /* Bytes of script not yet queued */
+    bool first_part;    /* Next part of script starts the response */
+    void *script_state; /* State of handler for script, kept by executor */
+    bool keep_alive;    /* Keep connection after script response */
+    bool chunks;        /* Client of current request accepts chunks */
+    bool http10;        /* Current request is HTTP/1.0 */
+    bool done;          /* No more requests are read */
+    bool paused;        /* Not watched for input */
+    int pending;        /* Jobs queued but not yet answered */
+    struct __web_job *out, *out_tail; /* Responses not completely sent */
+    bool writing;       /* Waiting for room to send */
+} web_conn_t;
+
+/* Commands of a request, run by the executor */
+typedef struct __web_job {
+    web_conn_t *conn;
+    int fd;           /* Descriptor of conn, for report output */
+    bool script;      /* Commands are lines of a script */
+    bool chunked;     /* Response is sent in chunks, as parts */
+    bool first, last; /* Part starts or ends the response */
+    bool partial;     /* Output flushed while its job still runs */
+    bool chunks;      /* Output may be flushed before the job is done */
+    struct timespec flushed; /* Time output was last flushed */
+    bool keep_alive;  /* Keep connection after response */
+    bool http10;      /* Client only keeps connection if told so */
+    int file;         /* File to send instead of running commands, or -1 */
+    int status;       /* HTTP status of file response */
+    off_t offset;     /* Range of file to send */
+    size_t count;
+    off_t file_size;
+    char *out; /* Report output of the commands */
+    size_t outlen, outsize;
+    char head[256]; /* Header and chunk size, sent ahead of output */
+    size_t head_len;
+    char *tail; /* Sent after output: end of chunk, and of response */
+    size_t tail_len;
+    size_t sent; /* Bytes of head, output or file range, and tail sent */
+    struct __web_job *next;
+    char cmds[]; /* Command, or newline-separated lines of a script */
+} web_job_t;
 
+/* A byte written to wake[1] makes wake[0] readable for the consumer */
 typedef struct {
-    int fd;            /* descriptor for this buf */
-    int count;         /* unread byte in this buf */
-    char *bufptr;      /* next unread byte in this buf */
-    char buf[BUFSIZE]; /* internal buffer */
-} rio_t;
+    web_job_t *head, *tail;
+    pthread_mutex_t lock;
+    int wake[2];
+} job_queue_t;
 
+/* An I/O thread either waits in its event loop, or, with io_uring, has
+ * the kernel accept and receive on its behalf, and handles completions.
+ */
+struct __web_worker {
+    pthread_t thread;
+    event_loop_t *loop;
+    job_queue_t done; /* Jobs run by the executor */
+    int listenfd;
+    uring_t *ring;         /* NULL when using loop */
+    bool accept_multishot; /* One accept request serves every connection */
+    bool poll_multishot;   /* One poll request serves every wakeup */
+    bool failed;           /* A request could not be queued again */
+    char *arena;           /* Registered buffers, or NULL */
+    int free_slots[WEB_URING_SLOTS];
+    int nfree;
+    struct list_head conns;
+};
+
+/* Request header, parsed in place.  Strings point into the buffer of the
+ * connection, and are valid until the request is consumed.
+ */
 typedef struct {
-    char filename[512];
-    off_t offset; /* for support Range */
-    size_t end;
+    char *target; /* Request target, not terminated */
+    size_t target_len;
+    char *filename; /* Decoded path of target, set by request_path */
+    off_t offset;   /* for support Range */
+    size_t end;   /* End of range, or 0 for end of file */
+    bool range;   /* Range given */
+    bool suffix;  /* Range is last tail bytes of file */
+    size_t tail;
+    size_t length;   /* Content-Length of request body */
+    bool keep_alive; /* Connection stays open after response */
+    bool chunks;     /* Client accepts chunked responses, from HTTP/1.1 */
+    bool http10;
+    bool post;       /* Body is a script of command lines */
 } http_request_t;
 
-static void rio_readinitb(rio_t *rp, int fd)
-{
-    rp->fd = fd;
-    rp->count = 0;
-    rp->bufptr = rp->buf;
-}
+/* Descriptor of connection whose request is being run, or 0 if none */
+int web_connfd;
 
-/* This is a wrapper for the Unix read() function that transfers min(n, count)
- * bytes from an internal buffer to a user buffer, where n is the number of
- * bytes requested by the user and count is the number of unread bytes in the
- * internal buffer. On entry, rio_read() refills the internal buffer via a call
- * to read() if the internal buffer is empty.
- */
-/* $begin rio_read */
-static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
-{
-    int cnt;
-    while (rp->count <= 0) { /* refill if buf is empty */
-        rp->count = read(rp->fd, rp->buf, sizeof(rp->buf));
-        if (rp->count < 0) {
-            if (errno != EINTR) /* interrupted by sig handler return */
-                return -1;
-        } else if (rp->count == 0) { /* EOF */
-            return 0;
-        } else
-            rp->bufptr = rp->buf; /* reset buffer ptr */
-    }
+/* Files and directories (ending with '/') served as they are */
+static char *web_files[WEB_MAXFILES];
+static int web_file_cnt = 0;
+static pthread_mutex_t web_files_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    /* Copy min(n, rp->count) bytes from internal buf to user buf */
-    cnt = n;
-    if (rp->count < n)
-        cnt = rp->count;
-    memcpy(usrbuf, rp->bufptr, cnt);
-    rp->bufptr += cnt;
-    rp->count -= cnt;
-    return cnt;
-}
+static job_queue_t exec_queue;
+static bool exec_ready = false;
+static web_handler_t web_handler;
+/* Job being run by the executor */
+static web_job_t *web_current = NULL;
 
 static ssize_t writen(int fd, void *usrbuf, size_t n)
 {
@@ -93,35 +210,207 @@ static ssize_t writen(int fd, void *usrbuf, size_t n)
     return n;
 }
 
-/* robustly read a text line (buffered) */
-static ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
-{
-    char c, *bufp = usrbuf;
+static void job_flush(web_job_t *job);
 
-    int n;
-    for (n = 1; n < maxlen; n++) {
-        int rc;
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-            *bufp++ = c;
-            if (c == '\n')
-                break;
-        } else if (rc == 0) {
-            if (n == 1)
-                return 0; /* EOF, no data read */
-            break;        /* EOF, some data was read */
-        } else
-            return -1; /* error */
-    }
-    *bufp = 0;
-    return n;
+/* Is output collected by job due to be sent before the job is done? */
+static bool job_flush_due(web_job_t *job)
+{
+    if (!job->chunks)
+        return false;
+    if (job->outlen >= WEB_FLUSH_SIZE)
+        return true;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long ms = (now.tv_sec - job->flushed.tv_sec) * 1000 +
+              (now.tv_nsec - job->flushed.tv_nsec) / 1000000;
+    return ms >= WEB_FLUSH_INTERVAL;
 }
 
+/* Output of the job being run is collected, so that the I/O thread can
+ * send it in few system calls.  Output of long or verbose commands is
+ * passed on in parts as it grows.
+ */
 void web_send(int out_fd, char *buf)
 {
-    writen(out_fd, buf, strlen(buf));
+    web_job_t *job = web_current;
+    if (!job || job->fd != out_fd) {
+        writen(out_fd, buf, strlen(buf));
+        return;
+    }
+
+    size_t len = strlen(buf);
+    if (job->outlen + len > job->outsize) {
+        size_t size = job->outsize ? job->outsize : BUFSIZE;
+        while (size < job->outlen + len)
+            size *= 2;
+        char *out = realloc(job->out, size);
+        if (!out)
+            return;
+        job->out = out;
+        job->outsize = size;
+    }
+    memcpy(job->out + job->outlen, buf, len);
+    job->outlen += len;
+
+    if (job_flush_due(job))
+        job_flush(job);
+}
+
+static bool queue_init(job_queue_t *q)
+{
+    q->head = q->tail = NULL;
+    if (pthread_mutex_init(&q->lock, NULL) != 0 || pipe(q->wake) < 0)
+        return false;
+    /* A full pipe already wakes the consumer, so never block on it */
+    for (int i = 0; i < 2; i++) {
+        int flags = fcntl(q->wake[i], F_GETFL);
+        if (flags < 0 || fcntl(q->wake[i], F_SETFL, flags | O_NONBLOCK) < 0)
+            return false;
+    }
+    return true;
+}
+
+static void queue_push(job_queue_t *q, web_job_t *job)
+{
+    job->next = NULL;
+    pthread_mutex_lock(&q->lock);
+    bool was_empty = !q->head;
+    if (q->tail)
+        q->tail->next = job;
+    else
+        q->head = job;
+    q->tail = job;
+    pthread_mutex_unlock(&q->lock);
+
+    /* Consumer takes the whole queue once woken */
+    if (was_empty && write(q->wake[1], "", 1) < 0) {
+        /* Pipe full: wakeup is already pending */
+    }
+}
+
+/* Take all jobs of q, in order */
+static web_job_t *queue_take(job_queue_t *q)
+{
+    char buf[64];
+    while (read(q->wake[0], buf, sizeof(buf)) > 0)
+        ;
+    pthread_mutex_lock(&q->lock);
+    web_job_t *job = q->head;
+    q->head = q->tail = NULL;
+    pthread_mutex_unlock(&q->lock);
+    return job;
+}
+
+/* Hand output collected so far by job, which is still running, to the I/O
+ * thread of its connection.  The response becomes chunked, unless it
+ * already is.
+ */
+static void job_flush(web_job_t *job)
+{
+    clock_gettime(CLOCK_MONOTONIC, &job->flushed);
+    web_job_t *part = calloc(1, sizeof(web_job_t));
+    if (!part)
+        return; /* Sent along with the rest */
+    part->conn = job->conn;
+    part->fd = job->fd;
+    part->file = -1;
+    part->chunked = true;
+    part->partial = true;
+    part->first = !job->chunked || job->first;
+    part->keep_alive = job->keep_alive;
+    part->http10 = job->http10;
+    part->out = job->out;
+    part->outlen = job->outlen;
+    part->outsize = job->outsize;
+
+    job->out = NULL;
+    job->outlen = job->outsize = 0;
+    job->chunked = true;
+    job->first = false;
+    /* Ahead of job itself, so parts arrive in order */
+    queue_push(&job->conn->worker->done, part);
+}
+
+static void web_accept(int fd, void *arg);
+static void web_execute(int fd, void *arg);
+static void web_answer(int fd, void *arg);
+static void web_complete(uint64_t data, int res, bool more, void *arg);
+
+/* io_uring of w can no longer be relied on, so stop serving.  Freeing the
+ * ring cancels its accept, leaving new connections to the other threads.
+ * Registered buffers may still be in use by the kernel, so the arena is
+ * kept.  Clients of connections of w see them shut down.
+ */
+static void uring_stop(web_worker_t *w)
+{
+    fprintf(stderr, "web: io_uring failed, I/O thread stops\n");
+    uring_free(w->ring);
+    w->ring = NULL;
+    web_conn_t *conn;
+    list_for_each_entry (conn, &w->conns, node) {
+        if (conn->fd >= 0)
+            shutdown(conn->fd, SHUT_RDWR);
+    }
 }
 
-int web_open(int port)
+static void *web_worker(void *arg)
+{
+    web_worker_t *w = arg;
+    while (true) {
+        if (!w->ring) {
+            event_wait(w->loop, -1);
+        } else if (uring_run(w->ring, web_complete, w) < 0 || w->failed) {
+            uring_stop(w);
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void uring_cleanup(web_worker_t *w)
+{
+    uring_free(w->ring);
+    free(w->arena);
+    w->ring = NULL;
+    w->arena = NULL;
+}
+
+/* Set up io_uring of w, and queue its first requests.  Receive buffers are
+ * registered if the kernel allows, so that it need not map them for every
+ * receive.  Return false if io_uring cannot be used.
+ */
+static bool uring_setup(web_worker_t *w)
+{
+    w->ring = uring_new(WEB_URING_ENTRIES);
+    if (!w->ring)
+        return false;
+
+    size_t size = (size_t) WEB_URING_SLOTS * (BUFSIZE + 1);
+    w->arena = malloc(size);
+    if (w->arena && uring_register_buffer(w->ring, w->arena, size)) {
+        for (int i = 0; i < WEB_URING_SLOTS; i++)
+            w->free_slots[i] = WEB_URING_SLOTS - 1 - i;
+        w->nfree = WEB_URING_SLOTS;
+    } else {
+        /* Locked memory limit reached, say */
+        free(w->arena);
+        w->arena = NULL;
+    }
+
+    /* Multishot requests may still be refused once submitted */
+    w->accept_multishot =
+        uring_accept(w->ring, w->listenfd, true, URING_ACCEPT);
+    w->poll_multishot = true;
+    if ((!w->accept_multishot &&
+         !uring_accept(w->ring, w->listenfd, false, URING_ACCEPT)) ||
+        !uring_poll(w->ring, w->done.wake[0], true, URING_WAKE)) {
+        uring_cleanup(w);
+        return false;
+    }
+    return true;
+}
+
+int web_open(int port, event_loop_t *loop, web_handler_t handler, bool *uring)
 {
     int listenfd, optval = 1;
     struct sockaddr_in serveraddr;
@@ -135,10 +424,12 @@ int web_open(int port)
                    sizeof(int)) < 0)
         return -1;
 
-    // 6 is TCP's protocol number
-    // enable this, much faster : 4000 req/s -> 17000 req/s
-    if (setsockopt(listenfd, 6, TCP_CORK, (const void *) &optval, sizeof(int)) <
-        0)
+    /* Each response goes out in a single write, so send it right away
+     * rather than waiting for more data on the persistent connection.
+     * Accepted sockets inherit this option.
+     */
+    if (setsockopt(listenfd, IPPROTO_TCP, TCP_NODELAY, (const void *) &optval,
+                   sizeof(int)) < 0)
         return -1;
 
     /* Listenfd will be an endpoint for all requests to port
@@ -153,78 +444,989 @@ int web_open(int port)
     /* Make it a listening socket ready to accept connection requests */
     if (listen(listenfd, LISTENQ) < 0)
         return -1;
+
+    if (!exec_ready) {
+        /* Jobs are run by the thread waiting on loop */
+        if (!queue_init(&exec_queue) ||
+            !event_add(loop, exec_queue.wake[0], web_execute, NULL))
+            return -1;
+        exec_ready = true;
+    }
+    web_handler = handler;
+
+    web_worker_t *workers = calloc(WEB_WORKERS, sizeof(web_worker_t));
+    if (!workers)
+        return -1;
+    for (int i = 0; i < WEB_WORKERS; i++) {
+        workers[i].listenfd = listenfd;
+        INIT_LIST_HEAD(&workers[i].conns);
+        if (!queue_init(&workers[i].done))
+            return -1;
+    }
+
+    bool use_uring = uring && *uring;
+    for (int i = 0; use_uring && i < WEB_WORKERS; i++) {
+        if (!uring_setup(&workers[i])) {
+            while (i-- > 0)
+                uring_cleanup(&workers[i]);
+            use_uring = false;
+        }
+    }
+    if (uring)
+        *uring = use_uring;
+
+    if (!use_uring) {
+        /* Connections are accepted until none is pending, so never block */
+        int flags = fcntl(listenfd, F_GETFL);
+        if (flags < 0 || fcntl(listenfd, F_SETFL, flags | O_NONBLOCK) < 0)
+            return -1;
+        for (int i = 0; i < WEB_WORKERS; i++) {
+            web_worker_t *w = &workers[i];
+            w->loop = event_loop_new();
+            if (!w->loop ||
+                !event_add(w->loop, w->done.wake[0], web_answer, w) ||
+                !event_add(w->loop, listenfd, web_accept, w))
+                return -1;
+        }
+    }
+
+    /* Signals such as SIGALRM must reach the thread running commands, so
+     * I/O threads block them all.  They inherit the mask set here.
+     */
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    for (int i = 0; i < WEB_WORKERS; i++)
+        pthread_create(&workers[i].thread, NULL, web_worker, &workers[i]);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
     return listenfd;
 }
 
-static void url_decode(char *src, char *dest, int max)
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20; /* Lower case */
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+/* Decode len bytes of src into dest, which may be src itself.  Return
+ * length of result, which is not terminated.
+ */
+static size_t url_decode(char *src, size_t len, char *dest)
 {
-    char *p = src;
-    char code[3] = {0};
-    while (*p && --max) {
-        if (*p == '%') {
-            memcpy(code, ++p, 2);
-            *dest++ = (char) strtoul(code, NULL, 16);
-            p += 2;
+    char *d = dest;
+    for (size_t i = 0; i < len; i++) {
+        int hi, lo;
+        if (src[i] == '%' && i + 2 < len && (hi = hex_value(src[i + 1])) >= 0 &&
+            (lo = hex_value(src[i + 2])) >= 0) {
+            *d++ = (char) (hi << 4 | lo);
+            i += 2;
         } else {
-            *dest++ = *p++;
+            *d++ = src[i];
         }
     }
-    *dest = '\0';
+    return d - dest;
+}
+
+/* Does line of length len start with header name, compared ignoring case?
+ * Return start of its value, or NULL.
+ */
+static char *header_value(char *line, size_t len, char *name)
+{
+    size_t n = strlen(name);
+    if (len < n || strncasecmp(line, name, n) != 0)
+        return NULL;
+    return line + n + strspn(line + n, " \t");
 }
 
-static void parse_request(int fd, http_request_t *req)
+/* Parse request line of length len */
+static void parse_request_line(char *line, size_t len, http_request_t *req)
 {
-    rio_t rio;
-    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE];
-    req->offset = 0;
-    req->end = 0; /* default */
+    char *end = line + len;
+    char *method_end = memchr(line, ' ', len);
+    if (!method_end)
+        method_end = end;
+    req->post = method_end - line == 4 && memcmp(line, "POST", 4) == 0;
+
+    char *target = method_end;
+    while (target < end && *target == ' ')
+        target++;
+    char *target_end = memchr(target, ' ', end - target);
+    if (!target_end)
+        target_end = end;
+    req->target = target;
+    req->target_len = target_end - target;
 
-    rio_readinitb(&rio, fd);
-    rio_readlineb(&rio, buf, MAXLINE);
-    sscanf(buf, "%1023s %1023s", method, uri); /* version is not cared */
-    /* read all */
-    while (buf[0] != '\n' && buf[1] != '\n') { /* \n || \r\n */
-        rio_readlineb(&rio, buf, MAXLINE);
-        if (buf[0] == 'R' && buf[1] == 'a' && buf[2] == 'n') {
-            sscanf(buf, "Range: bytes=%lu-%lu", (unsigned long *) &req->offset,
-                   (unsigned long *) &req->end);
-            /* Range: [start, end] */
-            if (req->end != 0)
-                req->end++;
+    char *version = target_end;
+    while (version < end && *version == ' ')
+        version++;
+    size_t vlen = end - version;
+    req->http10 = vlen == 8 && memcmp(version, "HTTP/1.0", 8) == 0;
+    /* Persistent by default from HTTP/1.1 on */
+    req->keep_alive = vlen > 0 && !req->http10;
+    req->chunks = req->keep_alive;
+}
+
+/* Parse header line of length len */
+static void parse_header(char *line, size_t len, http_request_t *req)
+{
+    char *value;
+    if ((value = header_value(line, len, "Content-Length:"))) {
+        req->length = strtoul(value, NULL, 10);
+    } else if ((value = header_value(line, len, "Connection:"))) {
+        if (strncasecmp(value, "close", 5) == 0)
+            req->keep_alive = false;
+        else if (strncasecmp(value, "keep-alive", 10) == 0)
+            req->keep_alive = true;
+    } else if ((value = header_value(line, len, "Range: bytes="))) {
+        /* Ranges that do not parse are ignored, serving the whole file */
+        char *rest;
+        if (*value == '-') {
+            /* Range: -n, the last n bytes */
+            if (value[1] < '0' || value[1] > '9')
+                return;
+            req->tail = strtoul(value + 1, NULL, 10);
+            req->suffix = req->range = true;
+            return;
         }
-    }
-    char *filename = uri;
-    if (uri[0] == '/') {
-        filename = uri + 1;
-        int length = strlen(filename);
-        if (length == 0) {
-            filename = ".";
-        } else {
-            for (int i = 0; i < length; ++i) {
-                if (filename[i] == '?') {
-                    filename[i] = '\0';
-                    break;
-                }
-            }
+        /* Range: start- or [start, end] */
+        if (*value < '0' || *value > '9')
+            return;
+        req->offset = strtoul(value, &rest, 10);
+        if (*rest != '-')
+            return;
+        if (rest[1] >= '0' && rest[1] <= '9') {
+            size_t last = strtoul(rest + 1, NULL, 10);
+            if (last < (size_t) req->offset)
+                return;
+            req->end = last + 1;
         }
+        req->range = true;
     }
-    url_decode(filename, req->filename, MAXLINE);
 }
 
-char *web_recv(int fd, struct sockaddr_in *clientaddr)
+/* Parse request header at start of buf, holding len bytes and terminated
+ * by a null character, in a single pass without copying.  Return length of
+ * the header including its terminating empty line, or 0 if it is not
+ * complete yet.
+ */
+static size_t parse_request(char *buf, size_t len, http_request_t *req)
 {
-    http_request_t req;
-    parse_request(fd, &req);
+    memset(req, 0, sizeof(*req));
+    char *line = buf, *end = buf + len;
+    bool first = true;
+    char *nl;
+    while ((nl = memchr(line, '\n', end - line))) {
+        size_t llen = nl - line;
+        if (llen > 0 && line[llen - 1] == '\r')
+            llen--;
+        if (llen == 0 && !first)
+            return nl + 1 - buf; /* Empty line ends the header */
+        if (first)
+            parse_request_line(line, llen, req);
+        else
+            parse_header(line, llen, req);
+        first = false;
+        line = nl + 1;
+    }
+    return 0;
+}
 
-    char *p = req.filename;
+/* Decode path named by target of req in place, and terminate it, so that
+ * filename can be used as a string.  The header must not be parsed again.
+ */
+static void request_path(http_request_t *req)
+{
+    char *path = req->target;
+    size_t len = req->target_len;
+    if (len > 0 && path[0] == '/') {
+        path++;
+        len--;
+    }
+    char *query = memchr(path, '?', len);
+    if (query)
+        len = query - path;
+    if (len == 0) {
+        req->filename = ".";
+        return;
+    }
+    len = url_decode(path, len, path);
+    path[len] = '\0';
+    req->filename = path;
+}
+
+/* Return command requested by req, which stays in the buffer of the
+ * connection
+ */
+static char *web_recv(http_request_t *req)
+{
+    char *p = req->filename;
     /* Change '/' to ' ' */
     while (*p) {
         ++p;
         if (*p == '/')
             *p = ' ';
     }
-    char *ret = malloc(strlen(req.filename) + 1);
-    strncpy(ret, req.filename, strlen(req.filename) + 1);
+    return req->filename;
+}
+
+/* Send as much of iov as fits on socket fd without blocking.  Return
+ * number of bytes sent, or -1 on error, with errno EAGAIN if none fit.
+ */
+static ssize_t send_iov(int fd, struct iovec *iov, int cnt)
+{
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = cnt};
+    while (true) {
+        /* Report a closed connection as error instead of raising SIGPIPE */
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n >= 0 || errno != EINTR)
+            return n;
+    }
+}
+
+static void job_free(web_job_t *job)
+{
+    if (job->file >= 0)
+        close(job->file);
+    free(job->out);
+    free(job);
+}
+
+/* Free conn once it is closed and no job, receive or poll refers to it */
+static void conn_release(web_conn_t *conn)
+{
+    if (conn->fd >= 0 || conn->pending > 0 || conn->armed || conn->writing)
+        return;
+    web_worker_t *w = conn->worker;
+    if (conn->slot >= 0)
+        w->free_slots[w->nfree++] = conn->slot;
+    list_del(&conn->node);
+    free(conn);
+}
+
+static bool job_submit(web_conn_t *conn, char *cmds, size_t len, bool script);
+
+static void conn_close(web_conn_t *conn)
+{
+    /* Executor still has to finish with script cut short */
+    if (conn->in_script && !conn->first_part) {
+        conn->in_script = false;
+        conn->script_left = 0;
+        job_submit(conn, "", 0, true);
+    }
+
+    uring_t *ring = conn->worker->ring;
+    if (!ring) {
+        if (!conn->paused)
+            event_del(conn->worker->loop, conn->fd);
+        if (conn->writing)
+            event_del_write(conn->worker->loop, conn->fd);
+        conn->writing = false;
+        close(conn->fd);
+    } else {
+        /* Receive or poll in flight still refers to conn, so end it now */
+        if (conn->armed || conn->writing)
+            shutdown(conn->fd, SHUT_RDWR);
+        if (!uring_close(ring, conn->fd, URING_CLOSE))
+            close(conn->fd);
+    }
+    conn->fd = -1;
+
+    /* Responses not sent yet are dropped */
+    while (conn->out) {
+        web_job_t *job = conn->out;
+        conn->out = job->next;
+        if (!job->partial)
+            conn->pending--;
+        job_free(job);
+    }
+    conn->out_tail = NULL;
+    conn_release(conn);
+}
+
+/* Stop watching conn for input */
+static void conn_pause(web_conn_t *conn)
+{
+    if (!conn->paused) {
+        if (!conn->worker->ring)
+            event_del(conn->worker->loop, conn->fd);
+        conn->paused = true;
+    }
+}
+
+/* Wait for more input on conn.  An event loop keeps watching it anyway,
+ * while io_uring is asked for one receive at a time.
+ */
+static void conn_more(web_conn_t *conn)
+{
+    uring_t *ring = conn->worker->ring;
+    if (!ring || conn->armed || conn->paused)
+        return;
+
+    char *buf = conn->buf + conn->len;
+    size_t n = BUFSIZE - conn->len;
+    uint64_t tag = (uintptr_t) conn;
+    if (conn->slot >= 0)
+        conn->armed = uring_read_fixed(ring, conn->fd, buf, n, tag);
+    else
+        conn->armed = uring_recv(ring, conn->fd, buf, n, tag);
+    if (!conn->armed)
+        conn_close(conn);
+}
+
+/* Drop first n bytes from buffer of conn */
+static void conn_consume(web_conn_t *conn, size_t n)
+{
+    conn->len -= n;
+    memmove(conn->buf, conn->buf + n, conn->len + 1);
+}
+
+/* Queue job with the len bytes of commands at cmds, which are copied into
+ * the job itself
+ */
+static bool job_submit(web_conn_t *conn, char *cmds, size_t len, bool script)
+{
+    web_job_t *job = malloc(sizeof(web_job_t) + len + 1);
+    if (!job)
+        return false;
+    memset(job, 0, sizeof(web_job_t));
+    memcpy(job->cmds, cmds, len);
+    job->cmds[len] = '\0';
+    job->conn = conn;
+    job->fd = conn->fd;
+    job->file = -1;
+    job->script = script;
+    job->chunked = script && conn->chunks;
+    job->chunks = conn->chunks;
+    job->last = true;
+    job->keep_alive = conn->keep_alive;
+    job->http10 = conn->http10;
+    if (script) {
+        job->first = conn->first_part;
+        job->last = conn->script_left == 0;
+        conn->first_part = false;
+    }
+    conn->pending++;
+    queue_push(&exec_queue, job);
+    return true;
+}
+
+void web_add_file(char *path)
+{
+    pthread_mutex_lock(&web_files_lock);
+    bool found = false;
+    for (int i = 0; i < web_file_cnt; i++)
+        found = found || strcmp(web_files[i], path) == 0;
+    if (!found && web_file_cnt < WEB_MAXFILES) {
+        char *copy = strdup(path);
+        if (copy)
+            web_files[web_file_cnt++] = copy;
+    }
+    pthread_mutex_unlock(&web_files_lock);
+}
+
+/* Is path one of the files served, or a file directly in a directory
+ * served?
+ */
+static bool file_served(char *path)
+{
+    bool found = false;
+    pthread_mutex_lock(&web_files_lock);
+    for (int i = 0; i < web_file_cnt && !found; i++) {
+        char *name = web_files[i];
+        size_t len = strlen(name);
+        if (len > 0 && name[len - 1] == '/') {
+            char *rest = path + len;
+            found = strncmp(path, name, len) == 0 && *rest &&
+                    !strchr(rest, '/') && strcmp(rest, "..") != 0 &&
+                    strcmp(rest, ".") != 0;
+        } else {
+            found = strcmp(path, name) == 0;
+        }
+    }
+    pthread_mutex_unlock(&web_files_lock);
+    return found;
+}
+
+/* Queue response sending range of file requested by req, which is served.
+ * Return false if req does not name a regular file.
+ */
+static bool file_submit(web_conn_t *conn, http_request_t *req)
+{
+    int fd = open(req->filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    web_job_t *job = calloc(1, sizeof(web_job_t));
+    if (!job) {
+        close(fd);
+        return false;
+    }
+    job->conn = conn;
+    job->fd = conn->fd;
+    job->last = true;
+    job->keep_alive = conn->keep_alive;
+    job->http10 = conn->http10;
+    job->file = fd;
+    job->file_size = st.st_size;
+
+    off_t start = req->offset;
+    off_t end = req->end ? req->end : st.st_size;
+    if (req->suffix)
+        start = req->tail < st.st_size ? st.st_size - req->tail : 0;
+    if (end > st.st_size)
+        end = st.st_size;
+    if (!req->range) {
+        job->status = 200;
+        job->count = st.st_size;
+    } else if (start < end) {
+        job->status = 206;
+        job->offset = start;
+        job->count = end - start;
+    } else {
+        job->status = 416; /* Range Not Satisfiable */
+    }
+
+    /* Passed through the executor to keep responses in order */
+    conn->pending++;
+    queue_push(&exec_queue, job);
+    return true;
+}
+
+/* Queue complete lines of script received on conn.
+ * Return false if more input is needed first.
+ */
+static bool queue_script(web_conn_t *conn)
+{
+    size_t used = conn->len;
+    if (used > conn->script_left)
+        used = conn->script_left;
+    if (used < conn->script_left) {
+        /* Only complete lines */
+        while (used > 0 && conn->buf[used - 1] != '\n')
+            used--;
+        if (used == 0) {
+            if (conn->len == BUFSIZE)
+                conn_close(conn); /* Line too long */
+            else
+                conn_more(conn);
+            return false;
+        }
+    }
+
+    conn->script_left -= used;
+    conn->in_script = conn->script_left > 0;
+    if (!job_submit(conn, conn->buf, used, true)) {
+        conn_close(conn);
+        return false;
+    }
+    conn_consume(conn, used);
+    /* Last part of script is queued, so the response can be finished */
+    if (!conn->in_script && !conn->keep_alive)
+        conn->done = true;
+    return true;
+}
+
+/* Queue jobs for the requests buffered on conn */
+static void web_parse(web_conn_t *conn)
+{
+    while (!conn->done && conn->pending < WEB_MAXPENDING) {
+        if (conn->in_script) {
+            if (!queue_script(conn))
+                return;
+            continue;
+        }
+
+        http_request_t req;
+        size_t hlen = parse_request(conn->buf, conn->len, &req);
+        if (!hlen) {
+            if (conn->len == BUFSIZE)
+                conn_close(conn); /* Header too long */
+            else
+                conn_more(conn);
+            return;
+        }
+        conn->keep_alive = req.keep_alive;
+        conn->chunks = req.chunks;
+        conn->http10 = req.http10;
+
+        if (req.post) {
+            /* Without chunks, closing the connection ends the response */
+            if (!req.chunks)
+                conn->keep_alive = false;
+            /* Body is queued as it arrives, so it may be of any length */
+            conn_consume(conn, hlen);
+            conn->in_script = true;
+            conn->script_left = req.length;
+            conn->first_part = true;
+        } else {
+            /* Compared before adding, which a huge length would overflow */
+            if (req.length > BUFSIZE - hlen) {
+                conn_close(conn); /* Body does not fit */
+                return;
+            }
+            size_t total = hlen + req.length;
+            if (total > conn->len) {
+                conn_more(conn); /* Wait for rest of body */
+                return;
+            }
+            /* Paths that do not name a file served are commands */
+            request_path(&req);
+            bool sent = file_served(req.filename) && file_submit(conn, &req);
+            if (!sent) {
+                char *cmd = web_recv(&req);
+                if (!job_submit(conn, cmd, strlen(cmd), false)) {
+                    conn_close(conn);
+                    return;
+                }
+            }
+            conn_consume(conn, total);
+            if (!req.keep_alive)
+                conn->done = true;
+        }
+    }
+
+    /* Connection is closed once its last job is answered */
+    conn_pause(conn);
+}
+
+/* Collect n bytes received on conn, or handle its error or end of input,
+ * and queue every request that is complete.
+ */
+static void conn_received(web_conn_t *conn, ssize_t n)
+{
+    conn->armed = false;
+    if (conn->fd < 0) {
+        conn_release(conn); /* Closed while receiving */
+        return;
+    }
+    if (n < 0 || (n == 0 && conn->pending == 0)) {
+        conn_close(conn);
+        return;
+    }
+    if (n == 0) {
+        /* Client is done sending, but still waits for responses */
+        conn->done = true;
+        conn_pause(conn);
+        return;
+    }
+    conn->len += n;
+    conn->buf[conn->len] = '\0';
 
-    return ret;
+    web_parse(conn);
+}
+
+/* Reads never block, so a slow client cannot hold up other connections */
+static void web_read(int fd, void *arg)
+{
+    web_conn_t *conn = arg;
+    ssize_t n = recv(fd, conn->buf + conn->len, BUFSIZE - conn->len,
+                     MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+    conn_received(conn, n);
+}
+
+/* Run each command of job, collecting its report output */
+static void job_run(web_job_t *job)
+{
+    web_current = job;
+    web_connfd = job->fd;
+    clock_gettime(CLOCK_MONOTONIC, &job->flushed);
+    if (!job->script) {
+        void *state = NULL;
+        web_handler(job->cmds, &state);
+        web_handler(NULL, &state);
+    } else {
+        void **state = &job->conn->script_state;
+        char *line = job->cmds;
+        while (*line) {
+            char *nl = strchr(line, '\n');
+            if (nl)
+                *nl = '\0';
+            web_handler(line, state);
+            if (!nl)
+                break;
+            line = nl + 1;
+        }
+        if (job->last)
+            web_handler(NULL, state);
+    }
+    web_connfd = 0;
+    web_current = NULL;
+}
+
+/* Run queued jobs in order of arrival, and hand them back to I/O threads */
+static void web_execute(int fd, void *arg)
+{
+    web_job_t *job = queue_take(&exec_queue);
+    while (job) {
+        web_job_t *next = job->next;
+        if (job->file < 0)
+            job_run(job);
+        queue_push(&job->conn->worker->done, job);
+        job = next;
+    }
+}
+
+/* Send up to count bytes of file from offset on socket fd without
+ * blocking.  Return number of bytes sent, or -1 on error, with errno EAGAIN
+ * if none fit.
+ */
+static ssize_t send_file(int fd, int file, off_t offset, size_t count)
+{
+    ssize_t n;
+#if defined(__linux__)
+    /* sendfile takes no flag not to block, so the socket does not block for
+     * the call only.  Receives queued in io_uring were issued blocking, and
+     * stay so.
+     */
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+    /* Data goes from page cache to socket without a copy through us */
+    do {
+        n = sendfile(fd, file, &offset, count);
+    } while (n < 0 && errno == EINTR);
+    int err = errno;
+    fcntl(fd, F_SETFL, flags);
+    errno = err;
+#else
+    char buf[BUFSIZE];
+    do {
+        n = pread(file, buf, count < BUFSIZE ? count : BUFSIZE, offset);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) {
+        struct iovec iov = {.iov_base = buf, .iov_len = n};
+        n = send_iov(fd, &iov, 1);
+    }
+#endif
+    if (n == 0) {
+        errno = EIO; /* File got shorter */
+        return -1;
+    }
+    return n;
+}
+
+/* Set header of response, or part of response, of job, and what follows
+ * its output
+ */
+/* Connection header of response of job, if any is needed */
+static const char *job_connection(web_job_t *job)
+{
+    if (!job->keep_alive)
+        return "Connection: close\r\n";
+    /* Persistence is only the default from HTTP/1.1 on */
+    return job->http10 ? "Connection: keep-alive\r\n" : "";
+}
+
+static void job_prepare(web_job_t *job)
+{
+    char *head = job->head;
+    size_t size = sizeof(job->head);
+    int len = 0;
+    job->tail = "";
+
+    if (job->file >= 0) {
+        char range[96] = "";
+        if (job->status == 206) {
+            snprintf(range, sizeof(range),
+                     "Content-Range: bytes %lu-%lu/%lu\r\n",
+                     (unsigned long) job->offset,
+                     (unsigned long) (job->offset + job->count - 1),
+                     (unsigned long) job->file_size);
+        } else if (job->status == 416) {
+            snprintf(range, sizeof(range), "Content-Range: bytes */%lu\r\n",
+                     (unsigned long) job->file_size);
+        }
+        len = snprintf(head, size,
+                       "HTTP/1.1 %d %s\r\n"
+                       "Content-Type: text/plain\r\n"
+                       "Accept-Ranges: bytes\r\n"
+                       "Content-Length: %lu\r\n%s%s\r\n",
+                       job->status,
+                       job->status == 200   ? "OK"
+                       : job->status == 206 ? "Partial Content"
+                                            : "Range Not Satisfiable",
+                       (unsigned long) job->count, range,
+                       job_connection(job));
+    } else if (!job->chunked && job->script) {
+        /* Parts are sent as they are, up to closing the connection */
+        if (job->first) {
+            len = snprintf(head, size,
+                           "HTTP/1.1 200 OK\r\n"
+                           "Content-Type: text/plain\r\n"
+                           "Connection: close\r\n\r\n");
+        }
+    } else if (!job->chunked) {
+        len = snprintf(head, size,
+                       "HTTP/1.1 200 OK\r\n"
+                       "Content-Type: text/plain\r\n"
+                       "Content-Length: %lu\r\n%s\r\n",
+                       (unsigned long) job->outlen,
+                       job_connection(job));
+    } else {
+        if (job->first) {
+            len = snprintf(head, size,
+                           "HTTP/1.1 200 OK\r\n"
+                           "Content-Type: text/plain\r\n"
+                           "Transfer-Encoding: chunked\r\n%s\r\n",
+                           job_connection(job));
+        }
+        /* Empty chunk ends the response */
+        if (job->outlen > 0) {
+            len += snprintf(head + len, size - len, "%lx\r\n",
+                            (unsigned long) job->outlen);
+            job->tail = job->last ? "\r\n0\r\n\r\n" : "\r\n";
+        } else if (job->last) {
+            job->tail = "0\r\n\r\n";
+        }
+    }
+    job->head_len = len;
+    job->tail_len = strlen(job->tail);
+}
+
+/* Send what is left of response of job on socket fd.  Return 1 once it is
+ * all sent, 0 if the socket has no room for more yet, or -1 on error.
+ */
+static int job_send(int fd, web_job_t *job)
+{
+    size_t body = job->file >= 0 ? job->count : job->outlen;
+    size_t total = job->head_len + body + job->tail_len;
+
+    while (job->sent < total) {
+        ssize_t n;
+        if (job->file >= 0 && job->sent >= job->head_len) {
+            size_t done = job->sent - job->head_len;
+            n = send_file(fd, job->file, job->offset + done,
+                          job->count - done);
+        } else {
+            /* What is left of head, output and tail, in one call */
+            char *base[3] = {job->head, job->out, job->tail};
+            size_t len[3] = {job->head_len, job->file >= 0 ? 0 : job->outlen,
+                             job->tail_len};
+            struct iovec iov[3];
+            size_t skip = job->sent;
+            int cnt = 0;
+            for (int i = 0; i < 3; i++) {
+                if (skip >= len[i]) {
+                    skip -= len[i];
+                    continue;
+                }
+                iov[cnt].iov_base = base[i] + skip;
+                iov[cnt++].iov_len = len[i] - skip;
+                skip = 0;
+            }
+            n = send_iov(fd, iov, cnt);
+        }
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        job->sent += n;
+    }
+    return 1;
+}
+
+static void web_write(int fd, void *arg);
+
+/* Wait for room to send on conn if on, or stop waiting.  Return false on
+ * failure.
+ */
+static bool conn_want_write(web_conn_t *conn, bool on)
+{
+    web_worker_t *w = conn->worker;
+    if (on == conn->writing)
+        return true;
+    if (w->ring) {
+        /* A poll is over once it completes */
+        if (on)
+            conn->writing = uring_poll_write(
+                w->ring, conn->fd, (uintptr_t) conn | URING_WRITABLE);
+        return !on || conn->writing;
+    }
+    if (on && !event_add_write(w->loop, conn->fd, web_write, conn))
+        return false;
+    if (!on)
+        event_del_write(w->loop, conn->fd);
+    conn->writing = on;
+    return true;
+}
+
+/* Send responses queued on conn as far as its socket takes them.  Then
+ * close conn after its last response, or read more requests once few
+ * enough are pending.
+ */
+static void conn_send(web_conn_t *conn)
+{
+    while (conn->out) {
+        web_job_t *job = conn->out;
+        int res = job_send(conn->fd, job);
+        if (res == 0)
+            break;
+        conn->out = job->next;
+        if (!conn->out)
+            conn->out_tail = NULL;
+        /* Its job stays pending until its response is sent */
+        if (!job->partial)
+            conn->pending--;
+        job_free(job);
+        if (res < 0) {
+            conn_close(conn);
+            return;
+        }
+    }
+    if (!conn_want_write(conn, conn->out != NULL)) {
+        conn_close(conn);
+        return;
+    }
+
+    web_worker_t *w = conn->worker;
+    if (conn->done && conn->pending == 0) {
+        conn_close(conn);
+    } else if (conn->paused && !conn->done &&
+               conn->pending < WEB_MAXPENDING) {
+        /* Resume reading, starting with requests already buffered */
+        conn->paused = false;
+        if (w->ring || event_add(w->loop, conn->fd, web_read, conn))
+            web_parse(conn);
+        else
+            conn_close(conn);
+    }
+}
+
+/* Socket of connection arg has room to send again */
+static void web_write(int fd, void *arg)
+{
+    conn_send(arg);
+}
+
+/* Queue responses of jobs run by the executor on their connections, and
+ * send them
+ */
+static void web_answer(int fd, void *arg)
+{
+    web_worker_t *w = arg;
+    web_job_t *job = queue_take(&w->done);
+    while (job) {
+        web_job_t *next = job->next;
+        web_conn_t *conn = job->conn;
+
+        if (conn->fd < 0) {
+            /* Closed while job was queued */
+            if (!job->partial)
+                conn->pending--;
+            job_free(job);
+            conn_release(conn);
+        } else {
+            job_prepare(job);
+            job->next = NULL;
+            if (conn->out_tail)
+                conn->out_tail->next = job;
+            else
+                conn->out = job;
+            conn->out_tail = job;
+            /* Otherwise sent once there is room */
+            if (!conn->writing)
+                conn_send(conn);
+        }
+        job = next;
+    }
+}
+
+/* Start serving connection connfd, using a registered buffer if one is
+ * left.
+ */
+static void conn_new(web_worker_t *w, int connfd)
+{
+    bool fixed = w->arena && w->nfree > 0;
+    web_conn_t *conn =
+        calloc(1, sizeof(web_conn_t) + (fixed ? 0 : BUFSIZE + 1));
+    if (!conn) {
+        close(connfd);
+        return;
+    }
+    conn->fd = connfd;
+    conn->worker = w;
+    if (fixed) {
+        conn->slot = w->free_slots[--w->nfree];
+        conn->buf = w->arena + (size_t) conn->slot * (BUFSIZE + 1);
+    } else {
+        conn->slot = -1;
+        conn->buf = (char *) (conn + 1);
+    }
+    conn->buf[0] = '\0';
+    list_add_tail(&conn->node, &w->conns);
+
+    if (w->ring) {
+        conn_more(conn);
+    } else if (!event_add(w->loop, connfd, web_read, conn)) {
+        close(connfd);
+        list_del(&conn->node);
+        free(conn);
+    }
+}
+
+/* Accept all pending connections on listening socket fd */
+static void web_accept(int fd, void *arg)
+{
+    web_worker_t *w = arg;
+    while (true) {
+        int connfd = accept(fd, NULL, NULL);
+        if (connfd < 0) {
+            if (errno == EINTR)
+                continue;
+            return; /* EAGAIN: no more pending connections */
+        }
+
+        conn_new(w, connfd);
+    }
+}
+
+/* Handle completion of io_uring request tagged data */
+static void web_complete(uint64_t data, int res, bool more, void *arg)
+{
+    web_worker_t *w = arg;
+    switch (data) {
+    case URING_ACCEPT:
+        if (res >= 0) {
+            conn_new(w, res);
+        } else if (res == -EINVAL) {
+            /* Kernel only accepts one at a time, or not at all */
+            w->failed |= !w->accept_multishot;
+            w->accept_multishot = false;
+        }
+        if (!more && !uring_accept(w->ring, w->listenfd, w->accept_multishot,
+                                   URING_ACCEPT))
+            w->failed = true;
+        break;
+    case URING_WAKE:
+        if (res == -EINVAL) {
+            w->failed |= !w->poll_multishot;
+            w->poll_multishot = false;
+        }
+        web_answer(w->done.wake[0], w);
+        if (!more && !uring_poll(w->ring, w->done.wake[0], w->poll_multishot,
+                                 URING_WAKE))
+            w->failed = true;
+        break;
+    case URING_CLOSE:
+        break;
+    default:
+        if (data & URING_WRITABLE) {
+            web_conn_t *conn =
+                (web_conn_t *) (uintptr_t) (data ^ URING_WRITABLE);
+            conn->writing = false;
+            if (conn->fd < 0)
+                conn_release(conn); /* Closed while polling */
+            else
+                conn_send(conn);
+        } else {
+            conn_received((web_conn_t *) (uintptr_t) data, res);
+        }
+    }
 }
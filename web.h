@@ -1,12 +1,33 @@
 #ifndef TINYWEB_H
 #define TINYWEB_H
 
-#include <netinet/in.h>
+#include <stdbool.h>
 
-int web_open(int port);
+#include "event.h"
 
-char *web_recv(int fd, struct sockaddr_in *clientaddr);
+/* Function run with each command requested by a connection.  *state is
+ * kept for the handler across the commands of one request or script,
+ * starting as NULL.  Once they are run, the handler is called with cmdline
+ * NULL to finish with it.
+ */
+typedef bool (*web_handler_t)(char *cmdline, void **state);
+
+/* Descriptor of connection whose request is being run, or 0 if none */
+extern int web_connfd;
+
+/* Listen on port, serving connections from loop.  If uring is given and
+ * set, connections are accepted and read through io_uring, and *uring is
+ * cleared if that is not available.  Return listening descriptor, or -1
+ * on failure.
+ */
+int web_open(int port, event_loop_t *loop, web_handler_t handler, bool *uring);
 
 void web_send(int out_fd, char *buffer);
 
+/* Serve file at path, relative to the working directory, instead of
+ * running it as a command.  A path ending with '/' serves every file
+ * directly within that directory.  Range requests are supported.
+ */
+void web_add_file(char *path);
+
 #endif
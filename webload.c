@@ -0,0 +1,379 @@
+/* Load generator for the web server of qtest.
+ *
+ * Keeps a number of connections to the server on localhost, and sends
+ * command requests over them, either as fast as responses come back, or
+ * at a fixed total rate.  Reports throughput and latency percentiles.
+ *
+ * At a fixed rate, latency is measured from the time a request was due,
+ * not from when it could be sent, so that a stalled server is not hidden
+ * by the requests it delayed.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event.h"
+
+#define BUFSIZE 8192 /* Longest response handled */
+
+/* Give up when no response arrives for this many seconds */
+#define STALL_TIMEOUT 10.0
+
+typedef struct {
+    int fd; /* -1 if not connected */
+    char buf[BUFSIZE + 1];
+    size_t len;
+    bool busy;  /* Waiting for response */
+    double due; /* Time current or next request is due */
+} load_conn_t;
+
+/* Options */
+static int port = 9999;
+static int nconns = 8;
+static unsigned long total = 10000;
+static double rate = 0; /* Requests per second, or 0 for no limit */
+static bool reconnect = false;
+static char *init_cmd = "new";
+static char **paths;
+static int npaths;
+
+static load_conn_t *conns;
+static unsigned long issued = 0, completed = 0, errors = 0;
+static double *latency; /* Of each completed request, in seconds */
+static double progress; /* Time last response arrived */
+static event_loop_t *loop;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void conn_close(load_conn_t *c)
+{
+    event_del(loop, c->fd);
+    close(c->fd);
+    c->fd = -1;
+    c->len = 0;
+}
+
+static void on_read(int fd, void *arg);
+
+static bool conn_open(load_conn_t *c)
+{
+    struct sockaddr_in addr;
+    int optval = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((unsigned short) port);
+
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd < 0)
+        return false;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    if (connect(c->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        !event_add(loop, c->fd, on_read, c)) {
+        close(c->fd);
+        c->fd = -1;
+        return false;
+    }
+    c->len = 0;
+    return true;
+}
+
+static bool conn_send(load_conn_t *c, char *path)
+{
+    char req[BUFSIZE];
+    int len = snprintf(req, sizeof(req), "GET /%s HTTP/1.1\r\n%s\r\n", path,
+                       reconnect ? "Connection: close\r\n" : "");
+    if (c->fd < 0 && !conn_open(c))
+        return false;
+    if (send(c->fd, req, len, MSG_NOSIGNAL) != len) {
+        conn_close(c);
+        return false;
+    }
+    c->busy = true;
+    return true;
+}
+
+/* Return length of chunked body, with the empty chunk ending it, in len
+ * bytes at body, or 0 if more is needed.  No trailer is expected.
+ */
+static size_t chunked_length(char *body, size_t len)
+{
+    size_t pos = 0;
+    while (true) {
+        char *eol = strstr(body + pos, "\r\n");
+        if (!eol)
+            return 0;
+        size_t size = strtoul(body + pos, NULL, 16);
+        pos = eol + 2 - body;
+        if (size == 0)
+            return len >= pos + 2 ? pos + 2 : 0;
+        /* Chunk data is followed by CRLF */
+        if (size > len || pos + size + 2 > len)
+            return 0;
+        pos += size + 2;
+    }
+}
+
+/* Return length of complete response at start of c->buf, or 0 if more is
+ * needed.  Set *status to its status code and *closing if the server closes
+ * the connection after it.
+ */
+static size_t response_length(load_conn_t *c, int *status, bool *closing)
+{
+    char *end = strstr(c->buf, "\r\n\r\n");
+    if (!end)
+        return 0;
+
+    size_t hlen = end + 4 - c->buf;
+    size_t clen = 0;
+    bool chunked = false;
+    *status = 0;
+    *closing = false;
+    sscanf(c->buf, "HTTP/%*s %d", status);
+    for (char *line = strstr(c->buf, "\r\n"); line && line < end;
+         line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0)
+            clen = strtoul(line + 17, NULL, 10);
+        else if (strncasecmp(line + 2, "Transfer-Encoding: chunked", 26) == 0)
+            chunked = true;
+        else if (strncasecmp(line + 2, "Connection: close", 17) == 0)
+            *closing = true;
+    }
+    if (chunked) {
+        clen = chunked_length(c->buf + hlen, c->len - hlen);
+        return clen ? hlen + clen : 0;
+    }
+    return c->len >= hlen + clen ? hlen + clen : 0;
+}
+
+static void complete(load_conn_t *c, bool ok)
+{
+    progress = now();
+    latency[completed++] = progress - c->due;
+    if (!ok)
+        errors++;
+    c->busy = false;
+    /* Requests of a connection fall due at even intervals */
+    if (rate > 0)
+        c->due += nconns / rate;
+}
+
+static void on_read(int fd, void *arg)
+{
+    load_conn_t *c = arg;
+    ssize_t n = recv(fd, c->buf + c->len, BUFSIZE - c->len, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0) {
+        /* Closed */
+        if (c->busy)
+            complete(c, false);
+        conn_close(c);
+        return;
+    }
+    c->len += n;
+    c->buf[c->len] = '\0';
+
+    int status;
+    bool closing;
+    size_t len = response_length(c, &status, &closing);
+    if (!len) {
+        if (c->len == BUFSIZE) {
+            /* Response too long to handle */
+            if (c->busy)
+                complete(c, false);
+            conn_close(c);
+        }
+        return;
+    }
+    if (c->busy)
+        complete(c, status == 200);
+    if (closing || reconnect) {
+        conn_close(c);
+    } else {
+        c->len -= len;
+        memmove(c->buf, c->buf + len, c->len + 1);
+    }
+}
+
+/* Send next request on every idle connection whose request is due.
+ * Return time the next request falls due, or INFINITY if none.
+ */
+static double send_due(double t)
+{
+    double next = INFINITY;
+    for (int i = 0; i < nconns && issued < total; i++) {
+        load_conn_t *c = &conns[i];
+        if (c->busy)
+            continue;
+        if (rate == 0) {
+            c->due = t;
+        } else if (c->due > t) {
+            if (c->due < next)
+                next = c->due;
+            continue;
+        }
+        if (!conn_send(c, paths[issued % npaths])) {
+            fprintf(stderr, "Cannot send request to port %d\n", port);
+            exit(EXIT_FAILURE);
+        }
+        issued++;
+    }
+    return next;
+}
+
+/* Run one request before measuring, such as one creating a queue */
+static void run_init()
+{
+    load_conn_t c = {.fd = -1};
+    int status;
+    bool closing;
+    if (!conn_send(&c, init_cmd)) {
+        fprintf(stderr, "Cannot connect to port %d\n", port);
+        exit(EXIT_FAILURE);
+    }
+    event_del(loop, c.fd);
+    while (true) {
+        ssize_t n = recv(c.fd, c.buf + c.len, BUFSIZE - c.len, 0);
+        if (n <= 0)
+            break;
+        c.len += n;
+        c.buf[c.len] = '\0';
+        if (response_length(&c, &status, &closing))
+            break;
+    }
+    close(c.fd);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(double p)
+{
+    return latency[(size_t) (p / 100 * (completed - 1))] * 1e6;
+}
+
+static void usage(char *cmd)
+{
+    printf("Usage: %s [-h] [-p PORT] [-c CONNS] [-n REQUESTS] [-r RATE] [-C] "
+           "[-i CMD] [PATH ...]\n",
+           cmd);
+    printf("\t-h          Print this information\n");
+    printf("\t-p PORT     Port of web server on localhost\n");
+    printf("\t-c CONNS    Number of concurrent connections\n");
+    printf("\t-n REQUESTS Number of requests to send\n");
+    printf("\t-r RATE     Total requests per second, unlimited if not given\n");
+    printf("\t-C          Open a new connection for every request\n");
+    printf("\t-i CMD      Command run once before measuring (default: new)\n");
+    printf("\tPATH        Commands requested in turn (default: size)\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    static char *default_paths[] = {"size"};
+    int c;
+
+    while ((c = getopt(argc, argv, "hp:c:n:r:Ci:")) != -1) {
+        switch (c) {
+        case 'h':
+            usage(argv[0]);
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'c':
+            nconns = atoi(optarg);
+            break;
+        case 'n':
+            total = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'C':
+            reconnect = true;
+            break;
+        case 'i':
+            init_cmd = optarg;
+            break;
+        default:
+            printf("Unknown option '%c'\n", c);
+            usage(argv[0]);
+            break;
+        }
+    }
+    if (nconns <= 0 || total == 0 || rate < 0) {
+        fprintf(stderr, "Invalid number of connections, requests or rate\n");
+        exit(EXIT_FAILURE);
+    }
+    if (optind < argc) {
+        paths = &argv[optind];
+        npaths = argc - optind;
+    } else {
+        paths = default_paths;
+        npaths = 1;
+    }
+
+    loop = event_loop_new();
+    conns = calloc(nconns, sizeof(load_conn_t));
+    latency = malloc(total * sizeof(double));
+    if (!loop || !conns || !latency) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    if (*init_cmd)
+        run_init();
+
+    /* Requests of connections are spread evenly over each interval */
+    double start = now();
+    for (int i = 0; i < nconns; i++) {
+        conns[i].fd = -1;
+        conns[i].due = rate > 0 ? start + i / rate : start;
+    }
+    progress = start;
+    while (completed < total) {
+        double t = now();
+        if (t - progress > STALL_TIMEOUT) {
+            fprintf(stderr, "No response for %.0f s, giving up\n",
+                    STALL_TIMEOUT);
+            exit(EXIT_FAILURE);
+        }
+        double next = send_due(t);
+        /* Waits are in whole milliseconds, so poll for the last one to
+         * send on time
+         */
+        int timeout = next == INFINITY ? 1000 : floor((next - t) * 1000);
+        event_wait(loop, timeout);
+    }
+    double elapsed = now() - start;
+
+    qsort(latency, completed, sizeof(double), cmp_double);
+    printf("%lu requests in %.2f s, %.0f requests/s, %lu errors\n", completed,
+           elapsed, completed / elapsed, errors);
+    printf("latency (us): min %.0f, 50%% %.0f, 90%% %.0f, 99%% %.0f, "
+           "99.9%% %.0f, max %.0f\n",
+           latency[0] * 1e6, percentile(50), percentile(90), percentile(99),
+           percentile(99.9), latency[completed - 1] * 1e6);
+    return errors ? EXIT_FAILURE : 0;
+}